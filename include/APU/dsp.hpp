@@ -0,0 +1,85 @@
+#pragma once
+#include <array>
+#include "spsc_queue.hpp"
+#include "utils.hpp"
+
+struct StereoSample {
+    s16 left;
+    s16 right;
+};
+
+// 32kHz stereo samples from the DSP, waiting for the frontend to play them. Holds 8192 samples, or about 256ms
+using AudioBuffer = SPSCQueue <StereoSample, 8192>;
+
+// The S-DSP, which mixes 8 voices of BRR compressed samples from the SPC700's RAM into a 32kHz stereo output, with an echo effect on top
+// The DSP is emulated a sample at a time rather than cycle by cycle. It doesn't hold on to the RAM, as the SPC700 (and us with it) gets copied on reset
+class DSP {
+public:
+    static constexpr int cyclesPerSample = 32; // The DSP outputs a sample every 32 SPC700 cycles
+
+    u8 read (u8 address) { return regs[address & 0x7F]; } // The registers are mirrored at $80-$FF
+    void write (u8 address, u8 value);
+
+    // Produce every sample due before the given SPC700 timestamp
+    void runUntil (u64 timestamp, u8* ram) {
+        while (cycles + cyclesPerSample <= timestamp) {
+            step (ram);
+            cycles += cyclesPerSample;
+        }
+    }
+
+private:
+    // Register addresses. Voice registers are at (voice << 4) | register, and global registers are in the 0xC-0xF columns
+    enum Register : u8 {
+        VolumeLeft = 0, VolumeRight, PitchLow, PitchHigh, Source, ADSR1, ADSR2, Gain, EnvelopeX, OutputX, // Voice registers
+        MainVolumeLeft = 0x0C, MainVolumeRight = 0x1C, EchoVolumeLeft = 0x2C, EchoVolumeRight = 0x3C,
+        KeyOn = 0x4C, KeyOff = 0x5C, Flags = 0x6C, EndX = 0x7C,
+        EchoFeedback = 0x0D, PitchModulation = 0x2D, NoiseEnable = 0x3D, EchoEnable = 0x4D,
+        SourceDirectory = 0x5D, EchoStart = 0x6D, EchoDelay = 0x7D,
+        FIR = 0x0F // FIR coefficients are at 0x0F, 0x1F, ..., 0x7F
+    };
+
+    enum class EnvelopeMode : u8 {
+        Attack, Decay, Sustain, Release
+    };
+
+    struct Voice {
+        // The last 3 samples of the previous BRR block, followed by the 16 of the current one, so interpolation never has to wrap around
+        std::array <s16, 3 + 16> samples {};
+        u16 blockAddress = 0; // Address of the current BRR block
+        u8 header = 0; // Header byte of the current BRR block
+        u32 position = 0; // Position in the current block, in 4.12 fixed point
+        int keyOnDelay = 0; // A voice stays silent for 5 samples after being keyed on
+
+        int envelope = 0; // 11 bits
+        int hiddenEnvelope = 0; // The envelope before clamping, which bent line GAIN mode looks at
+        EnvelopeMode mode = EnvelopeMode::Release;
+        s16 output = 0; // Output before volume, used for pitch modulation by the next voice
+    };
+
+    std::array <u8, 128> regs {};
+    std::array <Voice, 8> voices {};
+    u64 cycles = 0; // SPC700 timestamp of the next sample
+
+    u8 pendingKeyOn = 0; // KON writes are only acted on every other sample
+    bool everyOtherSample = false;
+    int counter = 0; // Global counter that times envelopes and noise. Counts down from 30720
+    u16 noise = 0x4000; // 15-bit LFSR
+
+    // Echo state. The history holds the last 8 samples read from the echo buffer twice over, so the 8 FIR taps are always contiguous
+    alignas(16) std::array <s16, 16> echoHistoryLeft {};
+    alignas(16) std::array <s16, 16> echoHistoryRight {};
+    int echoHistoryPos = 0;
+    u32 echoOffset = 0; // Offset into the echo buffer, in bytes
+    u32 echoLength = 0; // Size of the echo buffer. Latched when the offset wraps around
+
+    void step (u8* ram); // Produce 1 stereo sample
+    void keyOnVoice (Voice& voice, int index, const u8* ram);
+    void decodeBlock (Voice& voice, const u8* ram);
+    s16 interpolate (const Voice& voice) const;
+    void runEnvelope (Voice& voice, int index);
+    bool counterFired (int rate) const; // Is an event running at this rate due on this sample?
+    StereoSample runEcho (StereoSample main, StereoSample echoInput, u8* ram);
+
+    u8 voiceReg (int voice, Register reg) const { return regs[(voice << 4) | reg]; }
+};
@@ -2,6 +2,7 @@
 #include <array>
 #include "BitField.hpp"
 #include "utils.hpp"
+#include "APU/dsp.hpp"
 #include "APU/timers.hpp"
 
 union SPC_PSW {
@@ -118,6 +119,12 @@ private:
         2,8,4,5,4,5,5,6, 3,4,5,4,2,2,5,3,   // $f0-$ff   
     };
 
+    template <u8 opcode>
+    void execute(); // Specialized for every opcode in spc700.cpp, via the opcode list in spc700_opcodes.hpp
+
+    using OpcodeHandler = void (SPC700::*)();
+    static const std::array <OpcodeHandler, 256> opcodeHandlers;
+
     #include "../../src/APU/spc700_addressing.inl" // Inline files for CPU implementation
     #include "../../src/APU/spc700_instructions.inl"
 
@@ -125,7 +132,22 @@ public:
     u8 inputPorts[4] = { 0, 0, 0, 0 }; // The CPU writes to these ports, the APU reads from them
     u8 outputPorts[4] = { 0, 0, 0, 0 }; // The CPU reads from these ports, the APU writes to them
 
+    DSP dsp; // The sound chip, controlled through $F2/$F3
+
     void executeOpcode();
-    void runUntil (u64 timestamp);
+    void runInstructions (u64 timestamp);
+
+    // Run the SPC700 until the specified timestamp, then catch the DSP up to it
+    void runUntil (u64 timestamp) {
+        runInstructions (timestamp);
+        dsp.runUntil (cycles, ram.data());
+    }
+
+    // Run the SPC700 until it catches up to a master clock timestamp. The SPC700 is clocked at 1.024MHz, the master clock at 21.47727MHz
+    void catchUp (u64 masterTimestamp) {
+        runUntil (masterTimestamp * 102400 / 2147727);
+    }
+
     u8* getRAM() { return ram.data(); }
+    static void registerMMIO(); // Register the CPU side of the communication ports with the MMIO table
 };
\ No newline at end of file
@@ -0,0 +1,261 @@
+#pragma once
+
+// Every SPC700 opcode along with its implementation, expanded by each way of dispatching SPC700 instructions
+// OP is variadic, as some implementations contain commas in template argument lists
+#define SPC700_OPCODES(OP) \
+    OP(0x00, ) /* nop */                                                                     \
+    OP(0x01, call (read16(0xFFDE))) /* TCALL 0 */                                            \
+    OP(0x02, set <0>())                                                                      \
+    OP(0x03, bbs<0>())                                                                       \
+    OP(0x04, ora <SPC_AddressingModes::Direct>())                                            \
+    OP(0x05, ora <SPC_AddressingModes::Absolute>())                                          \
+    OP(0x06, ora <SPC_AddressingModes::Indirect>())                                          \
+    OP(0x07, ora <SPC_AddressingModes::Direct_indirect_x>())                                 \
+    OP(0x08, ora_imm())                                                                      \
+    OP(0x09, or_dp <SPC_Operands::Direct_byte>())                                            \
+    OP(0x0A, or1 <false>()) /* or1 c, mem, bit */                                            \
+    OP(0x0B, asl_mem <SPC_AddressingModes::Direct>())                                        \
+    OP(0x0C, asl_mem <SPC_AddressingModes::Absolute>())                                      \
+    OP(0x0D, push8 (psw.raw))                                                                \
+    OP(0x0E, tset1())                                                                        \
+    OP(0x0F, brk())                                                                          \
+    OP(0x10, jumpRelative (!psw.sign)) /* bpl */                                             \
+    OP(0x11, call (read16(0xFFDC))) /* TCALL 1 */                                            \
+    OP(0x12, clr <0>())                                                                      \
+    OP(0x13, bbc<0>())                                                                       \
+    OP(0x14, ora <SPC_AddressingModes::Direct_x>())                                          \
+    OP(0x15, ora <SPC_AddressingModes::Absolute_x>())                                        \
+    OP(0x16, ora <SPC_AddressingModes::Absolute_y>())                                        \
+    OP(0x17, ora <SPC_AddressingModes::Indirect_y>())                                        \
+    OP(0x18, or_dp <SPC_Operands::Immediate>())                                              \
+    OP(0x19, or_ip_ip())                                                                     \
+    OP(0x1A, decw())                                                                         \
+    OP(0x1B, asl_mem <SPC_AddressingModes::Direct_x>())                                      \
+    OP(0x1C, asl_accumulator())                                                              \
+    OP(0x1D, x = dec(x)) /* dec x */                                                         \
+    OP(0x1E, cmp_reg_mem <SPC_Operands::Register_x, SPC_AddressingModes::Absolute>())        \
+    OP(0x1F, pc = read16 (getAddress <SPC_AddressingModes::Absolute_x>())) /* jmp [abs+x] */ \
+    OP(0x20, psw.directPage = false; dpOffset = 0) /* clrp */                                \
+    OP(0x21, call (read16(0xFFDA))) /* TCALL 2 */                                            \
+    OP(0x22, set <1>())                                                                      \
+    OP(0x23, bbs<1>())                                                                       \
+    OP(0x24, anda <SPC_AddressingModes::Direct>())                                           \
+    OP(0x25, anda <SPC_AddressingModes::Absolute>())                                         \
+    OP(0x26, anda <SPC_AddressingModes::Indirect>())                                         \
+    OP(0x27, anda <SPC_AddressingModes::Direct_indirect_x>())                                \
+    OP(0x28, anda_imm())                                                                     \
+    OP(0x29, and_dp <SPC_Operands::Direct_byte>())                                           \
+    OP(0x2A, or1 <true>()) /* or1 c, !mem, bit */                                            \
+    OP(0x2B, rol_mem <SPC_AddressingModes::Direct>())                                        \
+    OP(0x2C, unimplemented (0x2C))                                                           \
+    OP(0x2D, push8(a))                                                                       \
+    OP(0x2E, cbne <SPC_AddressingModes::Direct>())                                           \
+    OP(0x2F, jumpRelative <false> (true)) /* bra */                                          \
+    OP(0x30, jumpRelative (psw.sign)) /* bmi */                                              \
+    OP(0x31, call (read16(0xFFD8))) /* TCALL 3 */                                            \
+    OP(0x32, clr <1>())                                                                      \
+    OP(0x33, bbc<1>())                                                                       \
+    OP(0x34, anda <SPC_AddressingModes::Direct_x>())                                         \
+    OP(0x35, anda <SPC_AddressingModes::Absolute_x>())                                       \
+    OP(0x36, anda <SPC_AddressingModes::Absolute_y>())                                       \
+    OP(0x37, anda <SPC_AddressingModes::Indirect_y>())                                       \
+    OP(0x38, and_dp <SPC_Operands::Immediate>())                                             \
+    OP(0x39, and_ip_ip())                                                                    \
+    OP(0x3A, incw())                                                                         \
+    OP(0x3B, unimplemented (0x3B))                                                           \
+    OP(0x3C, rol_accumulator())                                                              \
+    OP(0x3D, x = inc(x)) /* inc x */                                                         \
+    OP(0x3E, cmp_reg_mem <SPC_Operands::Register_x, SPC_AddressingModes::Direct>())          \
+    OP(0x3F, call (nextWord())) /* call abs */                                               \
+    OP(0x40, psw.directPage = true; dpOffset = 0x100) /* setp */                             \
+    OP(0x41, call (read16(0xFFD6))) /* TCALL 4 */                                            \
+    OP(0x42, set <2>())                                                                      \
+    OP(0x43, bbs<2>())                                                                       \
+    OP(0x44, eora <SPC_AddressingModes::Direct>())                                           \
+    OP(0x45, eora <SPC_AddressingModes::Absolute>())                                         \
+    OP(0x46, eora <SPC_AddressingModes::Indirect>())                                         \
+    OP(0x47, eora <SPC_AddressingModes::Direct_indirect_x>())                                \
+    OP(0x48, eora_imm())                                                                     \
+    OP(0x49, eor_dp <SPC_Operands::Direct_byte>())                                           \
+    OP(0x4A, and1 <false>()) /* and1 c, mem, bit */                                          \
+    OP(0x4B, lsr_mem <SPC_AddressingModes::Direct>())                                        \
+    OP(0x4C, lsr_mem <SPC_AddressingModes::Absolute>())                                      \
+    OP(0x4D, push8(x))                                                                       \
+    OP(0x4E, tclr1())                                                                        \
+    OP(0x4F, unimplemented (0x4F))                                                           \
+    OP(0x50, jumpRelative (!psw.overflow)) /* bvc */                                         \
+    OP(0x51, call (read16(0xFFD4))) /* TCALL 5 */                                            \
+    OP(0x52, clr <2>())                                                                      \
+    OP(0x53, bbc<2>())                                                                       \
+    OP(0x54, eora <SPC_AddressingModes::Direct_x>())                                         \
+    OP(0x55, eora <SPC_AddressingModes::Absolute_x>())                                       \
+    OP(0x56, eora <SPC_AddressingModes::Absolute_y>())                                       \
+    OP(0x57, eora <SPC_AddressingModes::Indirect_y>())                                       \
+    OP(0x58, eor_dp <SPC_Operands::Immediate>())                                             \
+    OP(0x59, eor_ip_ip())                                                                    \
+    OP(0x5A, cmpw())                                                                         \
+    OP(0x5B, unimplemented (0x5B))                                                           \
+    OP(0x5C, lsr_accumulator())                                                              \
+    OP(0x5D, mov <SPC_Operands::Register_x, SPC_Operands::Register_a>())                     \
+    OP(0x5E, cmp_reg_mem <SPC_Operands::Register_y, SPC_AddressingModes::Absolute>())        \
+    OP(0x5F, pc = read16 (pc)) /* jmp abs */                                                 \
+    OP(0x60, psw.carry = false) /* clrc */                                                   \
+    OP(0x61, call (read16(0xFFD2))) /* TCALL 6 */                                            \
+    OP(0x62, set <3>())                                                                      \
+    OP(0x63, bbs<3>())                                                                       \
+    OP(0x64, cmp_reg_mem <SPC_Operands::Register_a, SPC_AddressingModes::Direct>())          \
+    OP(0x65, cmp_reg_mem <SPC_Operands::Register_a, SPC_AddressingModes::Absolute>())        \
+    OP(0x66, unimplemented (0x66))                                                           \
+    OP(0x67, unimplemented (0x67))                                                           \
+    OP(0x68, cmp_reg <SPC_Operands::Register_a, SPC_Operands::Immediate>())                  \
+    OP(0x69, cmp_mem_reg <SPC_AddressingModes::Direct, SPC_Operands::Direct_byte>())         \
+    OP(0x6A, and1 <true>()) /* and1 c, !mem, bit */                                          \
+    OP(0x6B, ror_mem <SPC_AddressingModes::Direct>())                                        \
+    OP(0x6C, ror_mem <SPC_AddressingModes::Absolute>())                                      \
+    OP(0x6D, push8(y))                                                                       \
+    OP(0x6E, dbnz_dp())                                                                      \
+    OP(0x6F, ret())                                                                          \
+    OP(0x70, jumpRelative (psw.overflow)) /* bvs */                                          \
+    OP(0x71, call (read16(0xFFD0))) /* TCALL 7 */                                            \
+    OP(0x72, clr <3>())                                                                      \
+    OP(0x73, bbc<3>())                                                                       \
+    OP(0x74, cmp_reg_mem <SPC_Operands::Register_a, SPC_AddressingModes::Direct_x>())        \
+    OP(0x75, cmp_reg_mem <SPC_Operands::Register_a, SPC_AddressingModes::Absolute_x>())      \
+    OP(0x76, cmp_reg_mem <SPC_Operands::Register_a, SPC_AddressingModes::Absolute_y>())      \
+    OP(0x77, unimplemented (0x77))                                                           \
+    OP(0x78, cmp_mem_reg <SPC_AddressingModes::Direct, SPC_Operands::Immediate>())           \
+    OP(0x79, unimplemented (0x79))                                                           \
+    OP(0x7A, addw())                                                                         \
+    OP(0x7B, unimplemented (0x7B))                                                           \
+    OP(0x7C, ror_accumulator())                                                              \
+    OP(0x7D, mov <SPC_Operands::Register_a, SPC_Operands::Register_x>())                     \
+    OP(0x7E, cmp_reg_mem <SPC_Operands::Register_y, SPC_AddressingModes::Direct>())          \
+    OP(0x7F, unimplemented (0x7F))                                                           \
+    OP(0x80, psw.carry = true) /* setc */                                                    \
+    OP(0x81, call (read16(0xFFCE))) /* TCALL 8 */                                            \
+    OP(0x82, set <4>())                                                                      \
+    OP(0x83, bbs<4>())                                                                       \
+    OP(0x84, adc_mem <SPC_AddressingModes::Direct>())                                        \
+    OP(0x85, adc_mem <SPC_AddressingModes::Absolute>())                                      \
+    OP(0x86, adc_mem <SPC_AddressingModes::Indirect>())                                      \
+    OP(0x87, adc_mem <SPC_AddressingModes::Direct_indirect_x>())                             \
+    OP(0x88, a = adc(a, nextByte())) /* adc a, #imm */                                       \
+    OP(0x89, unimplemented (0x89))                                                           \
+    OP(0x8A, eor1()) /* eor1 c, mem, bit */                                                  \
+    OP(0x8B, dec_mem <SPC_AddressingModes::Direct>())                                        \
+    OP(0x8C, dec_mem <SPC_AddressingModes::Absolute>())                                      \
+    OP(0x8D, mov <SPC_Operands::Register_y, SPC_Operands::Immediate>())                      \
+    OP(0x8E, psw.raw = pop8(); dpOffset = psw.directPage ? 0x100 : 0)                        \
+    OP(0x8F, mov_mem <SPC_AddressingModes::Direct, SPC_Operands::Immediate>())               \
+    OP(0x90, jumpRelative (!psw.carry)) /* bcc */                                            \
+    OP(0x91, call (read16(0xFFCC))) /* TCALL 9 */                                            \
+    OP(0x92, clr <4>())                                                                      \
+    OP(0x93, bbc<4>())                                                                       \
+    OP(0x94, adc_mem <SPC_AddressingModes::Direct_x>())                                      \
+    OP(0x95, adc_mem <SPC_AddressingModes::Absolute_x>())                                    \
+    OP(0x96, adc_mem <SPC_AddressingModes::Absolute_y>())                                    \
+    OP(0x97, adc_mem <SPC_AddressingModes::Indirect_y>())                                    \
+    OP(0x98, adc_dp <SPC_Operands::Immediate>()) /* adc dp, #imm */                          \
+    OP(0x99, unimplemented (0x99))                                                           \
+    OP(0x9A, subw())                                                                         \
+    OP(0x9B, dec_mem <SPC_AddressingModes::Direct_x>())                                      \
+    OP(0x9C, a = dec(a)) /* dec a */                                                         \
+    OP(0x9D, mov <SPC_Operands::Register_x, SPC_Operands::Register_sp>())                    \
+    OP(0x9E, div())                                                                          \
+    OP(0x9F, xcn())                                                                          \
+    OP(0xA0, psw.interruptEnable = true) /* ei */                                            \
+    OP(0xA1, call (read16(0xFFCA))) /* TCALL 10 */                                           \
+    OP(0xA2, set <5>())                                                                      \
+    OP(0xA3, bbs<5>())                                                                       \
+    OP(0xA4, sbc_mem <SPC_AddressingModes::Direct>())                                        \
+    OP(0xA5, sbc_mem <SPC_AddressingModes::Absolute>())                                      \
+    OP(0xA6, sbc_mem <SPC_AddressingModes::Indirect>())                                      \
+    OP(0xA7, sbc_mem <SPC_AddressingModes::Direct_indirect_x>())                             \
+    OP(0xA8, a = sbc (a, nextByte())) /* SBC a, #imm */                                      \
+    OP(0xA9, unimplemented (0xA9))                                                           \
+    OP(0xAA, mov1()) /* mov1 c, mem, bit */                                                  \
+    OP(0xAB, inc_mem <SPC_AddressingModes::Direct>())                                        \
+    OP(0xAC, inc_mem <SPC_AddressingModes::Absolute>())                                      \
+    OP(0xAD, cmp_reg <SPC_Operands::Register_y, SPC_Operands::Immediate>())                  \
+    OP(0xAE, a = pop8())                                                                     \
+    OP(0xAF, write (x + dpOffset, a); x++) /* mov (x+), a */                                 \
+    OP(0xB0, jumpRelative (psw.carry)) /* bcs */                                             \
+    OP(0xB1, call (read16(0xFFC8))) /* TCALL 11 */                                           \
+    OP(0xB2, clr <5>())                                                                      \
+    OP(0xB3, bbc<5>())                                                                       \
+    OP(0xB4, sbc_mem <SPC_AddressingModes::Direct_x>())                                      \
+    OP(0xB5, sbc_mem <SPC_AddressingModes::Absolute_x>())                                    \
+    OP(0xB6, sbc_mem <SPC_AddressingModes::Absolute_y>())                                    \
+    OP(0xB7, sbc_mem <SPC_AddressingModes::Indirect_y>())                                    \
+    OP(0xB8, unimplemented (0xB8))                                                           \
+    OP(0xB9, unimplemented (0xB9))                                                           \
+    OP(0xBA, mov_ya_dp())                                                                    \
+    OP(0xBB, inc_mem <SPC_AddressingModes::Direct_x>())                                      \
+    OP(0xBC, a = inc(a)) /* inc a */                                                         \
+    OP(0xBD, mov <SPC_Operands::Register_sp, SPC_Operands::Register_x>())                    \
+    OP(0xBE, das()) /* das */                                                                \
+    OP(0xBF, a = read (x + dpOffset); x++; setNZ(a)) /* mov a, (x++) */                      \
+    OP(0xC0, psw.interruptEnable = false) /* di */                                           \
+    OP(0xC1, call (read16(0xFFC6))) /* TCALL 12 */                                           \
+    OP(0xC2, set <6>())                                                                      \
+    OP(0xC3, bbs<6>())                                                                       \
+    OP(0xC4, mov_mem <SPC_AddressingModes::Direct, SPC_Operands::Register_a>())              \
+    OP(0xC5, mov_mem <SPC_AddressingModes::Absolute, SPC_Operands::Register_a>())            \
+    OP(0xC6, mov_mem <SPC_AddressingModes::Indirect, SPC_Operands::Register_a>())            \
+    OP(0xC7, mov_mem <SPC_AddressingModes::Direct_indirect_x, SPC_Operands::Register_a>())   \
+    OP(0xC8, cmp_reg <SPC_Operands::Register_x, SPC_Operands::Immediate>())                  \
+    OP(0xC9, mov_mem <SPC_AddressingModes::Absolute, SPC_Operands::Register_x>())            \
+    OP(0xCA, unimplemented (0xCA))                                                           \
+    OP(0xCB, mov_mem <SPC_AddressingModes::Direct, SPC_Operands::Register_y>())              \
+    OP(0xCC, mov_mem <SPC_AddressingModes::Absolute, SPC_Operands::Register_y>())            \
+    OP(0xCD, mov <SPC_Operands::Register_x, SPC_Operands::Immediate>())                      \
+    OP(0xCE, x = pop8())                                                                     \
+    OP(0xCF, mul())                                                                          \
+    OP(0xD0, jumpRelative (!psw.zero)) /* bne */                                             \
+    OP(0xD1, call (read16(0xFFC4))) /* TCALL 13 */                                           \
+    OP(0xD2, clr <6>())                                                                      \
+    OP(0xD3, bbc<6>())                                                                       \
+    OP(0xD4, mov_mem <SPC_AddressingModes::Direct_x, SPC_Operands::Register_a>())            \
+    OP(0xD5, mov_mem <SPC_AddressingModes::Absolute_x, SPC_Operands::Register_a>())          \
+    OP(0xD6, mov_mem <SPC_AddressingModes::Absolute_y, SPC_Operands::Register_a>())          \
+    OP(0xD7, mov_mem <SPC_AddressingModes::Indirect_y, SPC_Operands::Register_a>())          \
+    OP(0xD8, mov_mem <SPC_AddressingModes::Direct, SPC_Operands::Register_x>())              \
+    OP(0xD9, unimplemented (0xD9))                                                           \
+    OP(0xDA, mov_dp_ya())                                                                    \
+    OP(0xDB, mov_mem <SPC_AddressingModes::Direct_x, SPC_Operands::Register_y>())            \
+    OP(0xDC, y = dec(y)) /* dec y */                                                         \
+    OP(0xDD, mov <SPC_Operands::Register_a, SPC_Operands::Register_y>())                     \
+    OP(0xDE, cbne <SPC_AddressingModes::Direct_x>())                                         \
+    OP(0xDF, daa()) /* daa */                                                                \
+    OP(0xE0, psw.halfCarry = false; psw.overflow = false) /* clrv */                         \
+    OP(0xE1, call (read16(0xFFC2))) /* TCALL 14 */                                           \
+    OP(0xE2, set <7>())                                                                      \
+    OP(0xE3, bbs<7>())                                                                       \
+    OP(0xE4, mov <SPC_Operands::Register_a, SPC_Operands::Direct_byte>())                    \
+    OP(0xE5, mova_mem <SPC_AddressingModes::Absolute>())                                     \
+    OP(0xE6, a = read (x + dpOffset); setNZ(a)) /* mov a, (x) */                             \
+    OP(0xE7, mova_mem <SPC_AddressingModes::Direct_indirect_x>())                            \
+    OP(0xE8, mov <SPC_Operands::Register_a, SPC_Operands::Immediate>())                      \
+    OP(0xE9, movx_mem <SPC_AddressingModes::Absolute>())                                     \
+    OP(0xEA, unimplemented (0xEA))                                                           \
+    OP(0xEB, mov <SPC_Operands::Register_y, SPC_Operands::Direct_byte>())                    \
+    OP(0xEC, movy_mem <SPC_AddressingModes::Absolute>())                                     \
+    OP(0xED, psw.carry = !psw.carry) /* notc */                                              \
+    OP(0xEE, y = pop8())                                                                     \
+    OP(0xEF, hang (0xEF)) /* sleep */                                                        \
+    OP(0xF0, jumpRelative (psw.zero)) /* beq */                                              \
+    OP(0xF1, call (read16(0xFFC0))) /* TCALL 15 */                                           \
+    OP(0xF2, clr <7>())                                                                      \
+    OP(0xF3, bbc<7>())                                                                       \
+    OP(0xF4, mova_mem <SPC_AddressingModes::Direct_x>())                                     \
+    OP(0xF5, mova_mem <SPC_AddressingModes::Absolute_x>())                                   \
+    OP(0xF6, mova_mem <SPC_AddressingModes::Absolute_y>())                                   \
+    OP(0xF7, mova_mem <SPC_AddressingModes::Indirect_y>())                                   \
+    OP(0xF8, mov <SPC_Operands::Register_x, SPC_Operands::Direct_byte>())                    \
+    OP(0xF9, unimplemented (0xF9))                                                           \
+    OP(0xFA, mov_dp_dp()) /* mov (dd), (ds) */                                               \
+    OP(0xFB, movy_mem <SPC_AddressingModes::Direct_x>())                                     \
+    OP(0xFC, y = inc(y)) /* inc y */                                                         \
+    OP(0xFD, mov <SPC_Operands::Register_y, SPC_Operands::Register_a>())                     \
+    OP(0xFE, dbnz_y())                                                                       \
+    OP(0xFF, hang (0xFF)) /* stop */
@@ -0,0 +1,54 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <vector>
+#include "CPU/opcodes.hpp"
+#include "utils.hpp"
+
+class CPU;
+
+// Cached interpreter for the 65816, a middle ground between the switch interpreter and the recompiler that works on any host
+// ROM-resident code is pre-decoded into basic blocks, stored per 2KB page. Each instruction keeps its operand bytes, length and base cycle count,
+// and loads, stores and ALU ops get handlers specialized for their addressing mode and the M/X flags, so they don't fetch or check anything when they run
+// There's a separate set of pages for each combination of the M and X flags, since they change how instructions are decoded.
+// Instructions that can change M or X (REP, SEP, PLP, XCE) end their block, so the next block gets looked up in the right set
+class CachedInterpreter {
+    struct DecodedInstruction;
+    using Handler = u32 (*)(CPU& cpu, const DecodedInstruction& instruction); // Runs an instruction and returns how many cycles it took
+
+    static constexpr unsigned pageSize = 2048;
+    static constexpr unsigned pageCount = 0x1000000 / pageSize;
+    static constexpr int maxBlockSize = 64; // How many instructions a block can hold at most
+
+    struct DecodedInstruction {
+        Handler handler;
+        u32 operand; // The operand bytes, little endian
+        u8 opcode;
+        u8 length; // Length in bytes, including the opcode
+        u8 cycles; // Base cycle count of specialized instructions. Penalties that depend on register values get added when they run
+        bool endsBlock; // Is this the last instruction of its block?
+    };
+
+    struct CachedPage {
+        std::array <u32, pageSize> blockStart; // Index + 1 of the block starting at each offset in the page. 0 means it's not decoded yet
+        std::vector <DecodedInstruction> instructions; // The decoded instructions of every block in this page, one block after the other
+
+        CachedPage() { blockStart.fill (0); }
+    };
+
+    std::array <std::unique_ptr <CachedPage>, pageCount> pages[4]; // One set of pages per M/X flag combination
+    static const std::array <Handler, 256> handlers[4]; // Handler for each opcode, per M/X flag combination
+
+    u32 decodeBlock (CachedPage& page, u32 address, bool shortAccumulator, bool shortIndex);
+
+    template <u8 opcode, bool shortAccumulator, bool shortIndex>
+    static u32 runInstruction (CPU& cpu, const DecodedInstruction& instruction);
+    static u32 runInterpreted (CPU& cpu, const DecodedInstruction& instruction); // Run an instruction through the interpreter's handler, which fetches its own operand
+
+    template <OperandMode mode, bool isWrite, bool shortIndex>
+    static u32 getAddress (CPU& cpu, u32 operand, u32& cycles);
+
+public:
+    u32 runBlock (CPU& cpu); // Run the block at the CPU's PB:PC, decoding it first if needed. Stops early at the next scheduler event. Returns how many cycles it took
+    void flush(); // Throw away all decoded blocks
+};
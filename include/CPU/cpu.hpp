@@ -1,7 +1,12 @@
 #pragma once
 #include <array>
+#include <unordered_map>
 #include "BitField.hpp"
 #include "memory.hpp"
+#include "CPU/cached_interpreter.hpp"
+#ifdef SNES_DYNAREC
+#include "CPU/dynarec.hpp"
+#endif
 #include "utils.hpp"
 
 union PSW {
@@ -33,22 +38,59 @@ public:
     u8 db = 0; // Data bank register
     u16 dpOffset = 0; // Direct page offset
 
-    PSW psw { .raw = 0x34 }; // Program status word (Boot with IRQs disabled, 8-bit registers)
+    PSW psw { .raw = 0x34 }; // Program status word (Boot with IRQs disabled, 8-bit registers). N and Z are evaluated lazily, so read it through getPSW()
     Accumulator a { .raw = 0 }; // The accumulator
     u16 x = 0; // Index registers
     u16 y = 0;
 
     bool emulationMode = true; // Just a stub. We don't actually emulate this because nothing uses it
     u32 cycles = 0; // Cycles last instruction took
+    bool useCachedInterpreter = false; // Run ROM code through the cached interpreter instead of decoding every instruction as we go
+    bool skipIdleLoops = true; // Fast-forward to the next event when the CPU is spinning in a loop that can't exit before it
+    bool waitingForInterrupt = false; // Set by WAI until the next interrupt fires
+    bool stopped = false; // Set by STP until the next reset
 
     void step();
+    void run(); // Run until the next scheduler event
     void reset();
 
+    // Runs one instruction whose opcode byte has already been fetched and decoded by the caller, and returns how many cycles it took
+    // These are used by the recompiler, which calls straight into them instead of going through executeOpcode
+    using OpcodeHandler = u32 (*)(CPU& cpu);
+    static const std::array <OpcodeHandler, 256> opcodeHandlers;
+
+    // Get the PSW with the lazily evaluated N and Z flags materialized. The N and Z bits of psw.raw itself are stale
+    u8 getPSW() const {
+        return (psw.raw & 0x7D) | (signFlag() << 7) | (zeroFlag() << 1);
+    }
+
     void fireNMI() {
+        waitingForInterrupt = false; // Interrupts wake the CPU up from WAI
         irq (Memory::cart.nmiVector);
     }
 
 private:
+    friend class CachedInterpreter; // The cached interpreter and the recompiler run some instructions themselves, so they need access to the internal state
+    friend class Dynarec;
+
+    CachedInterpreter cachedInterpreter;
+#ifdef SNES_DYNAREC
+    Dynarec dynarec;
+#endif
+
+    static constexpr int maxIdleLoopSize = 16; // How many bytes an idle loop's body can span at most
+    std::unordered_map <u64, bool> idleLoops; // Whether each short backwards branch in ROM is an idle loop, indexed by PB:PC and the state the loop body depends on
+
+    // Lazy N and Z flags. Instead of writing the PSW bitfields after every load and ALU op, we keep the last result around
+    // Z is set if zeroResult is 0, and N is bit 15 of signResult. 8-bit results are stored shifted left by 8 in signResult, so N is in the same spot for both widths
+    u16 zeroResult = 1;
+    u16 signResult = 0;
+
+    bool zeroFlag() const { return zeroResult == 0; }
+    bool signFlag() const { return signResult >> 15; }
+
+    u32 blockCycles = 0; // Cycles taken by the earlier instructions of the cached or recompiled block that's running, which aren't in the scheduler yet
+
     u32 pbOffset = 0; // pb << 16 and db << 16 respectively
     u32 dbOffset = 0; // Used so we don't have to shift on every memory access
 
@@ -61,8 +103,12 @@ private:
     }
 
     // Reads a word from memory[pb:pc] and increments pc by 2
+    // Operands almost always sit in the same ROM page, so read them with a single load before going through the memory handlers
     u16 nextWord() {
-        const auto value = Memory::read16 (pbOffset | pc);
+        const auto address = pbOffset | pc;
+        const auto pointer = Memory::pageTableRead[address >> 11];
+        const auto offset = address & Memory::pageMask;
+        const auto value = (pointer != nullptr && offset != Memory::pageMask) ? Helpers::readLE <u16> (&pointer[offset]) : Memory::read16 (address);
         pc += 2;
 
         return value;
@@ -110,18 +156,20 @@ private:
 
     // Set the N and Z flags depending on an 8-bit value
     void setNZ8 (u8 value) {
-        psw.zero = (value == 0);
-        psw.sign = (value >> 7);
+        zeroResult = value;
+        signResult = value << 8;
     }
     
     // Set the N and Z flags depending on a 16-bit value
     void setNZ16 (u16 value) {
-        psw.zero = (value == 0);
-        psw.sign = (value >> 15);
+        zeroResult = value;
+        signResult = value;
     }
 
     void setPSW (u8 value) {
         psw.raw = value;
+        zeroResult = psw.zero ? 0 : 1; // Move N and Z back into the lazy flags
+        signResult = psw.sign << 15;
 
         // If the short index bit is turned on, x and y's top bits are cleared. This is NOT true for the accumulator
         if (psw.shortIndex) {
@@ -131,6 +179,28 @@ private:
     }
 
     void executeOpcode (u8 opcode);
+    bool isIdleLoop (u16 target, u16 branchAddress);
+
+    // Fast-forward the scheduler to the next event, as the CPU can't do anything useful until then
+    // instructionCycles is how long the current instruction takes. Along with any block cycles that haven't been added to the scheduler yet,
+    // it gets added after we return, so stop short by that much and land right on the event
+    void skipToNextEvent (u32 instructionCycles = 0) {
+        const auto scheduler = Memory::scheduler;
+        const u64 pending = (u64) (blockCycles + instructionCycles) * 6;
+
+        if (scheduler->nextEventTimestamp >= pending && scheduler->timestamp < scheduler->nextEventTimestamp - pending)
+            scheduler->timestamp = scheduler->nextEventTimestamp - pending;
+    }
+
+    template <u8 opcode>
+    void execute(); // Specialized for every opcode in cpu.cpp, via the opcode list in opcodes.hpp
+
+    template <u8 opcode>
+    static u32 runOpcode (CPU& cpu) {
+        cpu.pc += 1; // Skip the opcode byte
+        cpu.execute <opcode>();
+        return cpu.cycles;
+    }
 
     // Instruction definitions are in inline header file because so templates don't anger the linker
     #include "../../src/CPU/addressing_modes.inl"
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "CPU/opcodes.hpp"
+#include "utils.hpp"
+
+class CPU;
+
+// x86-64 basic block recompiler for the 65816
+// Blocks are keyed by PB:PC and the M/X/E flags they were compiled under, as those change how instructions are decoded
+// Loads, stores, ALU ops, index increments, flag ops, branches and absolute jumps are compiled to native code, which computes addresses inline
+// and calls straight into Memory::read8/write8 and friends. Everything else becomes a call to the interpreter's opcode handler
+// Blocks check the scheduler after every instruction, and exit as soon as the next event is due
+class Dynarec {
+    using Block = u32 (*)(CPU* cpu); // A compiled block. Returns how many cycles it took to run
+
+    static constexpr size_t codeCacheSize = 16 * 1024 * 1024; // 16MB of executable memory for our blocks
+    static constexpr int maxBlockSize = 64; // How many instructions a block can hold at most
+    static constexpr size_t maxBlockBytes = 16 * 1024; // Upper bound on how much code a single block can emit
+
+    // x86-64 registers, in encoding order. The compiled code only uses the legacy ones as scratch registers, so no REX prefixes are needed for them
+    enum Reg : u8 { EAX = 0, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+
+    u8* codeCache = nullptr; // Start of our executable memory
+    u8* code = nullptr; // Where the next byte of code will be emitted
+    std::unordered_map <u32, Block> blocks; // Compiled blocks, indexed by their key
+    std::vector <u8*> exitJumps; // rel32 fields of the jumps to the current block's epilogue, patched once we know where it is
+
+    // Offsets of the CPU members that natively emitted code touches, relative to the CPU object
+    s32 pcOffset = 0;
+    s32 pswOffset = 0;
+    s32 aOffset = 0;
+    s32 xOffset = 0;
+    s32 yOffset = 0;
+    s32 directPageOffset = 0;
+    s32 dataBankOffset = 0;
+    s32 zeroResultOffset = 0;
+    s32 signResultOffset = 0;
+    s32 blockCyclesOffset = 0;
+
+    // Offsets of the scheduler's timestamp and deadline, relative to the scheduler object
+    s32 timestampOffset = 0;
+    s32 deadlineOffset = 0;
+
+    Block compileBlock (CPU& cpu, u32 key);
+    // Emit an instruction natively if we can. Returns false if we need to fall back to the interpreter handler
+    bool compileNative (u8 opcode, u32 operand, u16 pc, bool shortAccumulator, bool shortIndex);
+    void compileSimple (SimpleInstruction instruction, u32 operand, bool shortAccumulator, bool shortIndex);
+    bool compileBranch (u8 opcode, u16 pc, s8 displacement);
+
+    // Emitter functions
+    void emit8 (u8 value) { *code++ = value; }
+    void emit16 (u16 value) { std::memcpy (code, &value, sizeof(u16)); code += sizeof(u16); }
+    void emit32 (u32 value) { std::memcpy (code, &value, sizeof(u32)); code += sizeof(u32); }
+    void emit64 (u64 value) { std::memcpy (code, &value, sizeof(u64)); code += sizeof(u64); }
+
+    void emitPrologue();
+    void emitEpilogue();
+    void emitDeadlineCheck();
+    void emitHandlerCall (u8 opcode);
+    void emitCall (const void* function);
+    void emitStorePC (u16 value);
+    void emitAddCycles (u8 value);
+    void emitAddCyclesFrom (Reg reg);
+    void emitPSWAnd (u8 mask);
+    void emitPSWOr (u8 mask);
+    void emitPSWOrFrom (Reg reg);
+    void emitSetNZ (Reg value, bool is16Bit);
+    void emitAddress (OperandMode mode, u32 operand, bool isWrite, bool shortIndex);
+
+    // Instruction encodings. CPU members are addressed as [rbx + offset]
+    void emitMemoryOperand (u8 reg, s32 offset);
+    void emitLoadZeroExtended (Reg dest, s32 offset, bool is16Bit);
+    void emitLoad32 (Reg dest, s32 offset);
+    void emitStore (Reg source, s32 offset, bool is16Bit);
+    void emitMovImm (Reg dest, u32 value);
+    void emitALU (u8 opcode, Reg dest, Reg source);
+    void emitALUImm (u8 extension, Reg dest, u32 value);
+    void emitShift (u8 extension, Reg reg, u8 amount);
+    void emitZeroExtend (Reg reg, bool is16Bit);
+    void emitSetCC (u8 condition, Reg reg);
+
+public:
+    Dynarec();
+    ~Dynarec();
+
+    u32 runBlock (CPU& cpu); // Run the block at the CPU's PB:PC, compiling it first if needed. Returns how many cycles it took
+    void flush(); // Throw away all compiled blocks
+};
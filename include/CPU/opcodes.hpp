@@ -0,0 +1,417 @@
+#pragma once
+#include "utils.hpp"
+
+// Every 65816 opcode along with the CPU member that implements it
+// Each way of dispatching instructions (the switch interpreter, the handler tables, the recompiler...) expands this list
+// with its own definition of OP, so there's a single place to edit when an instruction implementation changes
+#define CPU_OPCODES(OP) \
+    OP(0x00, brk())                                                        \
+    OP(0x01, ora <AddressingModes::Direct_indirect_x>())                   \
+    OP(0x02, cop())                                                        \
+    OP(0x03, ora <AddressingModes::Stack_relative>())                      \
+    OP(0x04, tsb <AddressingModes::Direct>())                              \
+    OP(0x05, ora <AddressingModes::Direct>())                              \
+    OP(0x06, asl <AddressingModes::Direct>())                              \
+    OP(0x07, ora <AddressingModes::Direct_indirect_long>())                \
+    OP(0x08, php())                                                        \
+    OP(0x09, ora_imm())                                                    \
+    OP(0x0A, asl_accumulator())                                            \
+    OP(0x0B, phd())                                                        \
+    OP(0x0C, tsb <AddressingModes::Absolute>())                            \
+    OP(0x0D, ora <AddressingModes::Absolute>())                            \
+    OP(0x0E, asl <AddressingModes::Absolute>())                            \
+    OP(0x0F, ora <AddressingModes::Absolute_long>())                       \
+    OP(0x10, relativeJump (!signFlag())) /* bpl */                         \
+    OP(0x11, ora <AddressingModes::Direct_indirect_y>())                   \
+    OP(0x12, ora <AddressingModes::Direct_indirect>())                     \
+    OP(0x13, ora <AddressingModes::Stack_relative_indirect_indexed>())     \
+    OP(0x14, trb <AddressingModes::Direct>())                              \
+    OP(0x15, ora <AddressingModes::Direct_x>())                            \
+    OP(0x16, asl <AddressingModes::Direct_x>())                            \
+    OP(0x17, ora <AddressingModes::Direct_indirect_long_y>())              \
+    OP(0x18, clc())                                                        \
+    OP(0x19, ora <AddressingModes::Absolute_y>())                          \
+    OP(0x1A, ina())                                                        \
+    OP(0x1B, tcs())                                                        \
+    OP(0x1C, trb <AddressingModes::Absolute>())                            \
+    OP(0x1D, ora <AddressingModes::Absolute_x>())                          \
+    OP(0x1E, asl <AddressingModes::Absolute_x>())                          \
+    OP(0x1F, ora <AddressingModes::Absolute_long_x>())                     \
+    OP(0x20, jsr <AddressingModes::Absolute>())                            \
+    OP(0x21, and_ <AddressingModes::Direct_indirect_x>())                  \
+    OP(0x22, jsr <AddressingModes::Absolute_long>())                       \
+    OP(0x23, and_ <AddressingModes::Stack_relative>())                     \
+    OP(0x24, bit <AddressingModes::Direct>())                              \
+    OP(0x25, and_ <AddressingModes::Direct>())                             \
+    OP(0x26, rol <AddressingModes::Direct>())                              \
+    OP(0x27, and_ <AddressingModes::Direct_indirect_long>())               \
+    OP(0x28, plp())                                                        \
+    OP(0x29, and_imm())                                                    \
+    OP(0x2A, rol_accumulator())                                            \
+    OP(0x2B, pld())                                                        \
+    OP(0x2C, bit <AddressingModes::Absolute>())                            \
+    OP(0x2D, and_ <AddressingModes::Absolute>())                           \
+    OP(0x2E, rol <AddressingModes::Absolute>())                            \
+    OP(0x2F, and_ <AddressingModes::Absolute_long>())                      \
+    OP(0x30, relativeJump (signFlag())) /* bmi */                          \
+    OP(0x31, and_ <AddressingModes::Direct_indirect_y>())                  \
+    OP(0x32, and_ <AddressingModes::Direct_indirect>())                    \
+    OP(0x33, and_ <AddressingModes::Stack_relative_indirect_indexed>())    \
+    OP(0x34, bit <AddressingModes::Direct_x>())                            \
+    OP(0x35, and_ <AddressingModes::Direct_x>())                           \
+    OP(0x36, rol <AddressingModes::Direct_x>())                            \
+    OP(0x37, and_ <AddressingModes::Direct_indirect_long_y>())             \
+    OP(0x38, sec())                                                        \
+    OP(0x39, and_ <AddressingModes::Absolute_y>())                         \
+    OP(0x3A, dea())                                                        \
+    OP(0x3B, tsc())                                                        \
+    OP(0x3C, bit <AddressingModes::Absolute_x>())                          \
+    OP(0x3D, and_ <AddressingModes::Absolute_x>())                         \
+    OP(0x3E, rol <AddressingModes::Absolute_x>())                          \
+    OP(0x3F, and_ <AddressingModes::Absolute_long_x>())                    \
+    OP(0x40, rti())                                                        \
+    OP(0x41, eor <AddressingModes::Direct_indirect_x>())                   \
+    OP(0x42, wdm())                                                        \
+    OP(0x43, eor <AddressingModes::Stack_relative>())                      \
+    OP(0x44, mvp())                                                        \
+    OP(0x45, eor <AddressingModes::Direct>())                              \
+    OP(0x46, lsr <AddressingModes::Direct>())                              \
+    OP(0x47, eor <AddressingModes::Direct_indirect_long>())                \
+    OP(0x48, pha())                                                        \
+    OP(0x49, eor_imm())                                                    \
+    OP(0x4A, lsr_accumulator())                                            \
+    OP(0x4B, phk())                                                        \
+    OP(0x4C, jmp <AddressingModes::Absolute>())                            \
+    OP(0x4D, eor <AddressingModes::Absolute>())                            \
+    OP(0x4E, lsr <AddressingModes::Absolute>())                            \
+    OP(0x4F, eor <AddressingModes::Absolute_long>())                       \
+    OP(0x50, relativeJump (!psw.overflow)) /* bvc */                       \
+    OP(0x51, eor <AddressingModes::Direct_indirect_y>())                   \
+    OP(0x52, eor <AddressingModes::Direct_indirect>())                     \
+    OP(0x53, eor <AddressingModes::Stack_relative_indirect_indexed>())     \
+    OP(0x54, mvn())                                                        \
+    OP(0x55, eor <AddressingModes::Direct_x>())                            \
+    OP(0x56, lsr <AddressingModes::Direct_x>())                            \
+    OP(0x57, eor <AddressingModes::Direct_indirect_long_y>())              \
+    OP(0x58, cli())                                                        \
+    OP(0x59, eor <AddressingModes::Absolute_y>())                          \
+    OP(0x5A, phy())                                                        \
+    OP(0x5B, tcd())                                                        \
+    OP(0x5C, jmp <AddressingModes::Absolute_long>())                       \
+    OP(0x5D, eor <AddressingModes::Absolute_x>())                          \
+    OP(0x5E, lsr <AddressingModes::Absolute_x>())                          \
+    OP(0x5F, eor <AddressingModes::Absolute_long_x>())                     \
+    OP(0x60, rts())                                                        \
+    OP(0x61, adc_mem <AddressingModes::Direct_indirect_x>())               \
+    OP(0x62, per())                                                        \
+    OP(0x63, adc_mem <AddressingModes::Stack_relative>())                  \
+    OP(0x64, stz <AddressingModes::Direct>())                              \
+    OP(0x65, adc_mem <AddressingModes::Direct>())                          \
+    OP(0x66, ror <AddressingModes::Direct>())                              \
+    OP(0x67, adc_mem <AddressingModes::Direct_indirect_long>())            \
+    OP(0x68, pla())                                                        \
+    OP(0x69, adc_imm())                                                    \
+    OP(0x6A, ror_accumulator())                                            \
+    OP(0x6B, rtl())                                                        \
+    OP(0x6C, jmp <AddressingModes::Absolute_indirect>())                   \
+    OP(0x6D, adc_mem <AddressingModes::Absolute>())                        \
+    OP(0x6E, ror <AddressingModes::Absolute>())                            \
+    OP(0x6F, adc_mem <AddressingModes::Absolute_long>())                   \
+    OP(0x70, relativeJump (psw.overflow)) /* bvs */                        \
+    OP(0x71, adc_mem <AddressingModes::Direct_indirect_y>())               \
+    OP(0x72, adc_mem <AddressingModes::Direct_indirect>())                 \
+    OP(0x73, adc_mem <AddressingModes::Stack_relative_indirect_indexed>()) \
+    OP(0x74, stz <AddressingModes::Direct_x>())                            \
+    OP(0x75, adc_mem <AddressingModes::Direct_x>())                        \
+    OP(0x76, ror <AddressingModes::Direct_x>())                            \
+    OP(0x77, adc_mem <AddressingModes::Direct_indirect_long_y>())          \
+    OP(0x78, sei())                                                        \
+    OP(0x79, adc_mem <AddressingModes::Absolute_y>())                      \
+    OP(0x7A, ply())                                                        \
+    OP(0x7B, tdc())                                                        \
+    OP(0x7C, jmp <AddressingModes::Absolute_indirect_x>())                 \
+    OP(0x7D, adc_mem <AddressingModes::Absolute_x>())                      \
+    OP(0x7E, ror <AddressingModes::Absolute_x>())                          \
+    OP(0x7F, adc_mem <AddressingModes::Absolute_long_x>())                 \
+    OP(0x80, relativeJump (true)) /* bra */                                \
+    OP(0x81, sta <AddressingModes::Direct_indirect_x>())                   \
+    OP(0x82, brl())                                                        \
+    OP(0x83, sta <AddressingModes::Stack_relative>())                      \
+    OP(0x84, sty <AddressingModes::Direct>())                              \
+    OP(0x85, sta <AddressingModes::Direct>())                              \
+    OP(0x86, stx <AddressingModes::Direct>())                              \
+    OP(0x87, sta <AddressingModes::Direct_indirect_long>())                \
+    OP(0x88, dey())                                                        \
+    OP(0x89, bit_imm())                                                    \
+    OP(0x8A, txa())                                                        \
+    OP(0x8B, phb())                                                        \
+    OP(0x8C, sty <AddressingModes::Absolute>())                            \
+    OP(0x8D, sta <AddressingModes::Absolute>())                            \
+    OP(0x8E, stx <AddressingModes::Absolute>())                            \
+    OP(0x8F, sta <AddressingModes::Absolute_long>())                       \
+    OP(0x90, relativeJump (!psw.carry)) /* bcc */                          \
+    OP(0x91, sta <AddressingModes::Direct_indirect_y>())                   \
+    OP(0x92, sta <AddressingModes::Direct_indirect>())                     \
+    OP(0x93, sta <AddressingModes::Stack_relative_indirect_indexed>())     \
+    OP(0x94, sty <AddressingModes::Direct_x>())                            \
+    OP(0x95, sta <AddressingModes::Direct_x>())                            \
+    OP(0x96, stx <AddressingModes::Direct_y>())                            \
+    OP(0x97, sta <AddressingModes::Direct_indirect_long_y>())              \
+    OP(0x98, tya())                                                        \
+    OP(0x99, sta <AddressingModes::Absolute_y>())                          \
+    OP(0x9A, txs())                                                        \
+    OP(0x9B, txy())                                                        \
+    OP(0x9C, stz <AddressingModes::Absolute>())                            \
+    OP(0x9D, sta <AddressingModes::Absolute_x>())                          \
+    OP(0x9E, stz <AddressingModes::Absolute_x>())                          \
+    OP(0x9F, sta <AddressingModes::Absolute_long_x>())                     \
+    OP(0xA0, ldy_imm())                                                    \
+    OP(0xA1, lda <AddressingModes::Direct_indirect_x>())                   \
+    OP(0xA2, ldx_imm())                                                    \
+    OP(0xA3, lda <AddressingModes::Stack_relative>())                      \
+    OP(0xA4, ldy <AddressingModes::Direct>())                              \
+    OP(0xA5, lda <AddressingModes::Direct>())                              \
+    OP(0xA6, ldx <AddressingModes::Direct>())                              \
+    OP(0xA7, lda <AddressingModes::Direct_indirect_long>())                \
+    OP(0xA8, tay())                                                        \
+    OP(0xA9, lda_imm())                                                    \
+    OP(0xAA, tax())                                                        \
+    OP(0xAB, plb())                                                        \
+    OP(0xAC, ldy <AddressingModes::Absolute>())                            \
+    OP(0xAD, lda <AddressingModes::Absolute>())                            \
+    OP(0xAE, ldx <AddressingModes::Absolute>())                            \
+    OP(0xAF, lda <AddressingModes::Absolute_long>())                       \
+    OP(0xB0, relativeJump (psw.carry)) /* bcs */                           \
+    OP(0xB1, lda <AddressingModes::Direct_indirect_y>())                   \
+    OP(0xB2, lda <AddressingModes::Direct_indirect>())                     \
+    OP(0xB3, lda <AddressingModes::Stack_relative_indirect_indexed>())     \
+    OP(0xB4, ldy <AddressingModes::Direct_x>())                            \
+    OP(0xB5, lda <AddressingModes::Direct_x>())                            \
+    OP(0xB6, ldx <AddressingModes::Direct_y>())                            \
+    OP(0xB7, lda <AddressingModes::Direct_indirect_long_y>())              \
+    OP(0xB8, clv())                                                        \
+    OP(0xB9, lda <AddressingModes::Absolute_y>())                          \
+    OP(0xBA, tsx())                                                        \
+    OP(0xBB, tyx())                                                        \
+    OP(0xBC, ldy <AddressingModes::Absolute_x>())                          \
+    OP(0xBD, lda <AddressingModes::Absolute_x>())                          \
+    OP(0xBE, ldx <AddressingModes::Absolute_y>())                          \
+    OP(0xBF, lda <AddressingModes::Absolute_long_x>())                     \
+    OP(0xC0, cpy_imm())                                                    \
+    OP(0xC1, cmp <AddressingModes::Direct_indirect_x>())                   \
+    OP(0xC2, rep())                                                        \
+    OP(0xC3, cmp <AddressingModes::Stack_relative>())                      \
+    OP(0xC4, cpy <AddressingModes::Direct>())                              \
+    OP(0xC5, cmp <AddressingModes::Direct>())                              \
+    OP(0xC6, dec <AddressingModes::Direct>())                              \
+    OP(0xC7, cmp <AddressingModes::Direct_indirect_long>())                \
+    OP(0xC8, iny())                                                        \
+    OP(0xC9, cmp_imm())                                                    \
+    OP(0xCA, dex())                                                        \
+    OP(0xCB, wai())                                                        \
+    OP(0xCC, cpy <AddressingModes::Absolute>())                            \
+    OP(0xCD, cmp <AddressingModes::Absolute>())                            \
+    OP(0xCE, dec <AddressingModes::Absolute>())                            \
+    OP(0xCF, cmp <AddressingModes::Absolute_long>())                       \
+    OP(0xD0, relativeJump (!zeroFlag())) /* bne */                         \
+    OP(0xD1, cmp <AddressingModes::Direct_indirect_y>())                   \
+    OP(0xD2, cmp <AddressingModes::Direct_indirect>())                     \
+    OP(0xD3, cmp <AddressingModes::Stack_relative_indirect_indexed>())     \
+    OP(0xD4, pei())                                                        \
+    OP(0xD5, cmp <AddressingModes::Direct_x>())                            \
+    OP(0xD6, dec <AddressingModes::Direct_x>())                            \
+    OP(0xD7, cmp <AddressingModes::Direct_indirect_long_y>())              \
+    OP(0xD8, cld())                                                        \
+    OP(0xD9, cmp <AddressingModes::Absolute_y>())                          \
+    OP(0xDA, phx())                                                        \
+    OP(0xDB, stp())                                                        \
+    OP(0xDC, jmp <AddressingModes::Absolute_indirect_long>())              \
+    OP(0xDD, cmp <AddressingModes::Absolute_x>())                          \
+    OP(0xDE, dec <AddressingModes::Absolute_x>())                          \
+    OP(0xDF, cmp <AddressingModes::Absolute_long_x>())                     \
+    OP(0xE0, cpx_imm())                                                    \
+    OP(0xE1, sbc_mem <AddressingModes::Direct_indirect_x>())               \
+    OP(0xE2, sep())                                                        \
+    OP(0xE3, sbc_mem <AddressingModes::Stack_relative>())                  \
+    OP(0xE4, cpx <AddressingModes::Direct>())                              \
+    OP(0xE5, sbc_mem <AddressingModes::Direct>())                          \
+    OP(0xE6, inc <AddressingModes::Direct>())                              \
+    OP(0xE7, sbc_mem <AddressingModes::Direct_indirect_long>())            \
+    OP(0xE8, inx())                                                        \
+    OP(0xE9, sbc_imm())                                                    \
+    OP(0xEA, cycles = 2) /* nop */                                         \
+    OP(0xEB, xba())                                                        \
+    OP(0xEC, cpx <AddressingModes::Absolute>())                            \
+    OP(0xED, sbc_mem <AddressingModes::Absolute>())                        \
+    OP(0xEE, inc <AddressingModes::Absolute>())                            \
+    OP(0xEF, sbc_mem <AddressingModes::Absolute_long>())                   \
+    OP(0xF0, relativeJump (zeroFlag())) /* beq */                          \
+    OP(0xF1, sbc_mem <AddressingModes::Direct_indirect_y>())               \
+    OP(0xF2, sbc_mem <AddressingModes::Direct_indirect>())                 \
+    OP(0xF3, sbc_mem <AddressingModes::Stack_relative_indirect_indexed>()) \
+    OP(0xF4, pea())                                                        \
+    OP(0xF5, sbc_mem <AddressingModes::Direct_x>())                        \
+    OP(0xF6, inc <AddressingModes::Direct_x>())                            \
+    OP(0xF7, sbc_mem <AddressingModes::Direct_indirect_long_y>())          \
+    OP(0xF8, sed())                                                        \
+    OP(0xF9, sbc_mem <AddressingModes::Absolute_y>())                      \
+    OP(0xFA, plx())                                                        \
+    OP(0xFB, xce())                                                        \
+    OP(0xFC, jsr <AddressingModes::Absolute_indirect_x>())                 \
+    OP(0xFD, sbc_mem <AddressingModes::Absolute_x>())                      \
+    OP(0xFE, inc <AddressingModes::Absolute_x>())                          \
+    OP(0xFF, sbc_mem <AddressingModes::Absolute_long_x>())
+
+// How many bytes each instruction takes up, including the opcode. Immediate-addressed instructions depend on the M and X flags
+constexpr int instructionLength (u8 opcode, bool shortAccumulator, bool shortIndex) {
+    constexpr u8 lengths[256] = {
+        2,2,2,2,2,2,2,2, 1,2,1,1,3,3,3,4, // $00-$0F
+        2,2,2,2,2,2,2,2, 1,3,1,1,3,3,3,4, // $10-$1F
+        3,2,4,2,2,2,2,2, 1,2,1,1,3,3,3,4, // $20-$2F
+        2,2,2,2,2,2,2,2, 1,3,1,1,3,3,3,4, // $30-$3F
+        1,2,2,2,3,2,2,2, 1,2,1,1,3,3,3,4, // $40-$4F
+        2,2,2,2,3,2,2,2, 1,3,1,1,4,3,3,4, // $50-$5F
+        1,2,3,2,2,2,2,2, 1,2,1,1,3,3,3,4, // $60-$6F
+        2,2,2,2,2,2,2,2, 1,3,1,1,3,3,3,4, // $70-$7F
+        2,2,3,2,2,2,2,2, 1,2,1,1,3,3,3,4, // $80-$8F
+        2,2,2,2,2,2,2,2, 1,3,1,1,3,3,3,4, // $90-$9F
+        2,2,2,2,2,2,2,2, 1,2,1,1,3,3,3,4, // $A0-$AF
+        2,2,2,2,2,2,2,2, 1,3,1,1,3,3,3,4, // $B0-$BF
+        2,2,2,2,2,2,2,2, 1,2,1,1,3,3,3,4, // $C0-$CF
+        2,2,2,2,2,2,2,2, 1,3,1,1,3,3,3,4, // $D0-$DF
+        2,2,2,2,2,2,2,2, 1,2,1,1,3,3,3,4, // $E0-$EF
+        2,2,2,2,3,2,2,2, 1,3,1,1,3,3,3,4, // $F0-$FF
+    };
+
+    switch (opcode) {
+        case 0x09: case 0x29: case 0x49: case 0x69: case 0x89: case 0xA9: case 0xC9: case 0xE9: // Accumulator immediates
+            return lengths[opcode] + (shortAccumulator ? 0 : 1);
+        case 0xA0: case 0xA2: case 0xC0: case 0xE0: // Index register immediates
+            return lengths[opcode] + (shortIndex ? 0 : 1);
+        default:
+            return lengths[opcode];
+    }
+}
+
+// Does this instruction end a basic block? That's the case for anything that changes PB:PC in a non-linear way,
+// as well as for anything that can change the M, X or E flags, since those change how the following instructions are decoded
+constexpr bool endsBasicBlock (u8 opcode) {
+    switch (opcode) {
+        case 0x10: case 0x30: case 0x50: case 0x70: case 0x80: case 0x82: // Branches
+        case 0x90: case 0xB0: case 0xD0: case 0xF0:
+        case 0x4C: case 0x5C: case 0x6C: case 0x7C: case 0xDC: // Jumps
+        case 0x20: case 0x22: case 0xFC: case 0x60: case 0x6B: // Subroutine calls and returns
+        case 0x00: case 0x02: case 0x40: case 0xCB: case 0xDB: // BRK, COP, RTI, WAI, STP
+        case 0x44: case 0x54: // MVP and MVN loop by moving PC back
+        case 0xC2: case 0xE2: case 0x28: case 0xFB: // REP, SEP, PLP, XCE
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Loads, stores, ALU ops and index increments with operands that can be decoded ahead of time, as they only use
+// immediate, direct page, absolute or absolute long addressing. The cached interpreter and the recompiler run these without going through the opcode's handler
+enum class Operation : u8 {
+    None, // Anything else
+    ORA, AND, EOR, ADC, STA, LDA, CMP, SBC, STZ, // Accumulator-width operations
+    LDX, LDY, STX, STY, CPX, CPY, INX, INY, DEX, DEY // Index-width operations
+};
+
+enum class OperandMode : u8 {
+    Implied, Immediate, Direct, Direct_x, Direct_y, Absolute, Absolute_x, Absolute_y, Absolute_long, Absolute_long_x
+};
+
+struct SimpleInstruction {
+    Operation operation;
+    OperandMode mode;
+};
+
+constexpr SimpleInstruction simpleInstruction (u8 opcode) {
+    // The accumulator ops are laid out as aaabbb01 (and aaaxxx11 for long addressing), with aaa picking the operation and bbb the addressing mode
+    constexpr Operation accumulatorOps[8] = {
+        Operation::ORA, Operation::AND, Operation::EOR, Operation::ADC, Operation::STA, Operation::LDA, Operation::CMP, Operation::SBC
+    };
+
+    const auto accumulatorOp = accumulatorOps[opcode >> 5];
+    switch (opcode & 0x1F) {
+        case 0x05: return { accumulatorOp, OperandMode::Direct };
+        case 0x09: return opcode == 0x89 ? SimpleInstruction { Operation::None, OperandMode::Implied } : SimpleInstruction { accumulatorOp, OperandMode::Immediate }; // $89 is BIT #imm
+        case 0x0D: return { accumulatorOp, OperandMode::Absolute };
+        case 0x0F: return { accumulatorOp, OperandMode::Absolute_long };
+        case 0x15: return { accumulatorOp, OperandMode::Direct_x };
+        case 0x19: return { accumulatorOp, OperandMode::Absolute_y };
+        case 0x1D: return { accumulatorOp, OperandMode::Absolute_x };
+        case 0x1F: return { accumulatorOp, OperandMode::Absolute_long_x };
+    }
+
+    switch (opcode) {
+        case 0xA2: return { Operation::LDX, OperandMode::Immediate };
+        case 0xA6: return { Operation::LDX, OperandMode::Direct };
+        case 0xAE: return { Operation::LDX, OperandMode::Absolute };
+        case 0xB6: return { Operation::LDX, OperandMode::Direct_y };
+        case 0xBE: return { Operation::LDX, OperandMode::Absolute_y };
+
+        case 0xA0: return { Operation::LDY, OperandMode::Immediate };
+        case 0xA4: return { Operation::LDY, OperandMode::Direct };
+        case 0xAC: return { Operation::LDY, OperandMode::Absolute };
+        case 0xB4: return { Operation::LDY, OperandMode::Direct_x };
+        case 0xBC: return { Operation::LDY, OperandMode::Absolute_x };
+
+        case 0x86: return { Operation::STX, OperandMode::Direct };
+        case 0x8E: return { Operation::STX, OperandMode::Absolute };
+        case 0x96: return { Operation::STX, OperandMode::Direct_y };
+
+        case 0x84: return { Operation::STY, OperandMode::Direct };
+        case 0x8C: return { Operation::STY, OperandMode::Absolute };
+        case 0x94: return { Operation::STY, OperandMode::Direct_x };
+
+        case 0x64: return { Operation::STZ, OperandMode::Direct };
+        case 0x74: return { Operation::STZ, OperandMode::Direct_x };
+        case 0x9C: return { Operation::STZ, OperandMode::Absolute };
+        case 0x9E: return { Operation::STZ, OperandMode::Absolute_x };
+
+        case 0xE0: return { Operation::CPX, OperandMode::Immediate };
+        case 0xE4: return { Operation::CPX, OperandMode::Direct };
+        case 0xEC: return { Operation::CPX, OperandMode::Absolute };
+        case 0xC0: return { Operation::CPY, OperandMode::Immediate };
+        case 0xC4: return { Operation::CPY, OperandMode::Direct };
+        case 0xCC: return { Operation::CPY, OperandMode::Absolute };
+
+        case 0xE8: return { Operation::INX, OperandMode::Implied };
+        case 0xC8: return { Operation::INY, OperandMode::Implied };
+        case 0xCA: return { Operation::DEX, OperandMode::Implied };
+        case 0x88: return { Operation::DEY, OperandMode::Implied };
+
+        default: return { Operation::None, OperandMode::Implied };
+    }
+}
+
+constexpr bool isStore (Operation operation) {
+    return operation == Operation::STA || operation == Operation::STZ || operation == Operation::STX || operation == Operation::STY;
+}
+
+// Is the operation's width picked by the X flag rather than the M flag?
+constexpr bool usesIndexWidth (Operation operation) {
+    return operation >= Operation::LDX;
+}
+
+// Cycles a simple instruction takes under the given M and X flags. This matches CPU::getAddress, minus the penalties that depend on register values:
+// 1 cycle for direct page accesses when the low byte of D isn't 0, and 1 cycle for indexed absolute reads that cross a page with 8-bit index registers
+constexpr int baseCycles (SimpleInstruction instruction, bool shortAccumulator, bool shortIndex) {
+    const bool is16Bit = !(usesIndexWidth (instruction.operation) ? shortIndex : shortAccumulator);
+
+    switch (instruction.mode) {
+        case OperandMode::Implied: return 2;
+        case OperandMode::Immediate: return is16Bit ? 3 : 2;
+        case OperandMode::Direct: return is16Bit ? 4 : 3;
+        case OperandMode::Direct_x: case OperandMode::Direct_y: return is16Bit ? 5 : 4;
+        case OperandMode::Absolute: return is16Bit ? 5 : 4;
+        case OperandMode::Absolute_x: case OperandMode::Absolute_y: // Writes always take an extra cycle, reads do with 16-bit index registers
+            return (is16Bit ? 5 : 4) + ((isStore (instruction.operation) || !shortIndex) ? 1 : 0);
+        case OperandMode::Absolute_long: case OperandMode::Absolute_long_x: return is16Bit ? 6 : 5;
+    }
+
+    return 0;
+}
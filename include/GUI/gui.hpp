@@ -1,14 +1,18 @@
 #pragma once
 #include <SFML/Graphics.hpp>
 #include <thread>
+#include <vector>
 #include "imgui.h"
 #include "imgui-SFML.h"
 #include "imgui_memory_editor.h"
+#include "utils.hpp"
 
 class GUI {
     sf::RenderWindow window;
     sf::Clock deltaClock;
     sf::Texture display;
+    sf::Texture tileTexture; // The tile viewer's contents
+    std::vector <u32> tilePixels;
 
     MemoryEditor memoryEditor;
     MemoryEditor vramEditor;
@@ -29,6 +33,8 @@ private:
     void showDisplay();
     void showDMAInfo();
     void showPPURegisters();
+    void showTileViewer();
+    void updateTileViewer();
 
     void pingEmuThread();
     void waitEmuThread();
@@ -37,13 +43,17 @@ private:
     bool showSPCWindow = false;
     bool showSPCMemory = false;
     bool showCartWindow = false;
+    bool displayDirty = true; // Does the display texture need to be reuploaded?
     bool showMemoryEditor = false;
     bool showVramEditor = false;
     bool showDMAWindow = false;
     bool showPPUWindow = false;
+    bool showTileWindow = false;
 
     bool running = false; // Is the emulator running?
     bool vsync = true; // Is vsync enabled?
 
     int selectedDMAChannel = 0;
+    int tileViewerDepth = 0; // 0 = 2bpp, 1 = 4bpp, 2 = 8bpp
+    int tileViewerPalette = 0;
 };
\ No newline at end of file
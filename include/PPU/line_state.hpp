@@ -0,0 +1,60 @@
+#pragma once
+#include <cstring>
+#include "PPU/pixel_format.hpp"
+#include "utils.hpp"
+
+// Registers that affect how a line is drawn. Snapshots of these are sent to the render thread, and used to find lines that didn't change
+// Registers that are bitfield unions in the PPU are stored as their raw value, so snapshots can be copied around freely
+struct PPULineState {
+    int line;
+    int bufferIndex;
+    PixelFormat pixelFormat;
+
+    u8 bgmode;
+    u8 sc[4];
+    u8 nba[4];
+    u16 hofs[4];
+    u16 vofs[4];
+    u8 tm, ts;
+    u8 setini;
+    bool field;
+    int frameWidth, frameHeight;
+
+    u8 m7sel;
+    s16 m7a, m7b, m7c, m7d;
+    s16 m7x, m7y;
+    s16 m7hofs, m7vofs;
+
+    u8 objsel;
+    u16 oamaddr;
+
+    u8 windowSel[3];
+    u8 windowPos[4];
+    u16 windowLogic;
+    u8 tmw, tsw;
+    u8 cgwsel;
+    u8 cgadsub;
+    u16 fixedColour;
+};
+
+// Everything the pixels of a line depend on: The line's registers, and the generation counters of VRAM, CGRAM and OAM,
+// which change whenever their contents do. If a framebuffer line was drawn with the same signature, it doesn't have to be drawn again
+struct LineSignature {
+    PPULineState state;
+    u32 vramGeneration;
+    u32 cgramGeneration;
+    u32 oamGeneration;
+
+    // Signatures are always zeroed before being filled in, so the padding bytes compare equal too
+    bool operator== (const LineSignature& other) const { return std::memcmp (this, &other, sizeof (LineSignature)) == 0; }
+    bool operator!= (const LineSignature& other) const { return !(*this == other); }
+
+    // A signature no line can have, for framebuffer rows that haven't been drawn
+    static LineSignature none() {
+        LineSignature signature;
+        std::memset (&signature, 0, sizeof (signature));
+        signature.state.line = -1;
+
+        return signature;
+    }
+};
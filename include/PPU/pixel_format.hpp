@@ -0,0 +1,40 @@
+#pragma once
+#include "utils.hpp"
+
+// Pixel formats the PPU can write its framebuffers in
+enum class PixelFormat {
+    RGBA8888, // R, G, B, A bytes in memory. What the GUI uses
+    XRGB8888, // 0xXXRRGGBB words
+    RGB565,
+    BGR555, // The SNES' native format, as stored in CGRAM
+    Indexed8 // CGRAM indices. Colour math can't be represented in this format, so it's ignored
+};
+
+namespace PixelFormats {
+    constexpr int bytesPerPixel (PixelFormat format) {
+        switch (format) {
+            case PixelFormat::RGBA8888: case PixelFormat::XRGB8888: return 4;
+            case PixelFormat::RGB565: case PixelFormat::BGR555: return 2;
+            default: return 1;
+        }
+    }
+
+    // Convert a BGR555 colour to one of the colour formats. 16-bit formats are returned in the low half
+    template <PixelFormat format>
+    constexpr u32 fromBGR555 (u16 colour) {
+        const u8 red = colour & 0x1F;
+        const u8 green = (colour >> 5) & 0x1F;
+        const u8 blue = (colour >> 10) & 0x1F;
+
+        if constexpr (format == PixelFormat::RGBA8888)
+            return 0xFF000000 | Helpers::get8BitColor (red) | (Helpers::get8BitColor (green) << 8) | (Helpers::get8BitColor (blue) << 16);
+        else if constexpr (format == PixelFormat::XRGB8888)
+            return 0xFF000000 | (Helpers::get8BitColor (red) << 16) | (Helpers::get8BitColor (green) << 8) | Helpers::get8BitColor (blue);
+        else if constexpr (format == PixelFormat::RGB565)
+            return (red << 11) | (((green << 1) | (green >> 4)) << 5) | blue; // Green gets 6 bits, so its top bit is repeated at the bottom
+        else {
+            static_assert (format == PixelFormat::BGR555, "Indexed colours can't be converted from BGR555");
+            return colour & 0x7FFF;
+        }
+    }
+}
@@ -1,6 +1,11 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include "BitField.hpp"
+#include "PPU/line_state.hpp"
+#include "PPU/pixel_format.hpp"
+#include "PPU/tiles.hpp"
+#include "PPU/window.hpp"
 #include "utils.hpp"
 
 union OAMAddr {
@@ -39,12 +44,71 @@ union BGSC {
     BitField <0, 2, u8> size; // SC Size (0=One-Screen, 1=V-Mirror, 2=H-Mirror, 3=Four-Screen)
 };
 
-enum class Depth {
-    Bpp2, Bpp4, Bpp8
+union OBJSel {
+    u8 raw = 0;
+
+    BitField <0, 3, u8> nameBase; // Base address of OBJ tiles in VRAM (in 8K-word steps)
+    BitField <3, 2, u8> nameSelect; // Gap between the first and second 256 OBJ tiles, minus 1 (in 4K-word steps)
+    BitField <5, 3, u8> size; // Small and large OBJ size pair (See objSizes in obj.cpp)
+};
+
+union M7Sel {
+    u8 raw = 0;
+
+    BitField <0, 1, u8> hflip; // Flip the screen horizontally
+    BitField <1, 1, u8> vflip; // Flip the screen vertically
+    BitField <6, 2, u8> screenOver; // What to show outside the 1024x1024 map (0/1 = Wrap around, 2 = Transparent, 3 = Tile 0)
+};
+
+union SetIni {
+    u8 raw = 0;
+
+    BitField <0, 1, u8> interlace; // Draw 448 lines per frame, with every field drawing every other line. Latched at the start of the frame
+    BitField <1, 1, u8> objInterlace; // TODO
+    BitField <2, 1, u8> overscan; // TODO: 239 line frames
+    BitField <3, 1, u8> pseudoHires; // Show the sub screen in the even columns of a 512 pixel wide line, and the main screen in the odd ones
+    BitField <6, 1, u8> extbg; // TODO
+};
+
+union CGWSel {
+    u8 raw = 0;
+
+    BitField <0, 1, u8> directColour; // TODO
+    BitField <1, 1, u8> addSubscreen; // Do colour math with the sub screen instead of the fixed colour
+    BitField <4, 2, u8> preventMath; // Where colour math is disabled (0 = Nowhere, 1 = Outside the colour window, 2 = Inside it, 3 = Everywhere)
+    BitField <6, 2, u8> forceBlack; // Where the main screen is clipped to black. Same encoding as preventMath
 };
 
-enum class RenderPriority {
-    Low, High, Both
+union CGADSub {
+    u8 raw = 0;
+
+    BitField <0, 6, u8> layers; // Layers that colour math applies to: BG1-BG4, OBJ, backdrop
+    BitField <6, 1, u8> half; // Halve the result
+    BitField <7, 1, u8> subtract; // Subtract instead of adding
+};
+
+#ifdef SNES_THREADED_PPU
+class PPURenderThread;
+#endif
+
+// Which frames the PPU draws. Skipped frames still go through all of the PPU's timing (H/V counters, HBlank and VBlank flags, NMIs, HDMA)
+// and keep VRAM, CGRAM and OAM up to date. They just don't get drawn, so they only cost CPU and APU time
+enum class RenderPolicy {
+    EveryFrame,
+    EveryNthFrame, // Draw 1 frame out of every frameInterval
+    OnRequest, // Only draw the frames after a call to requestFrame
+    Never // For headless runs that don't look at the screen
+};
+
+// Layer indices for the compositor's line buffers
+enum Layer {
+    BG1 = 0, BG2, BG3, BG4, OBJ, LayerCount
+};
+
+// Where each layer sits in the priority order of a BG mode. Higher ranks are drawn in front, and 0 means the layer isn't displayed
+struct LayerRanks {
+    u8 bg[4][2]; // Indexed by BG and tile priority bit
+    u8 obj[4]; // Indexed by sprite priority
 };
 
 class PPU {
@@ -62,15 +126,49 @@ public:
     u8 nmitimen = 0;
     u8 hvbjoy = 0;
     u16 vramStep = 0; // Depending on vmain.step, this can be 1, 32 or 128
-    u8 tm = 0;
+    u8 tm = 0; // Layers enabled on the main screen
+    u8 ts = 0; // Layers enabled on the sub screen
 
     u8* buffers[2] = { nullptr, nullptr }; // 2 framebuffers for double buffering. One is used by the PPU while the other one is being rendered by the GUI
     int bufferIndex = 0; // We use double buffering so this swaps between 0 and 1
+    // Size of each framebuffer in pixels, which frontends need to read them. Buffers are sized for the frame drawn in them:
+    // 256 or 512 pixels wide, depending on whether the frame had hi-res lines, and 224 or 448 lines tall, depending on interlacing
+    int bufferWidth[2] = { 256, 256 };
+    int bufferHeight[2] = { 224, 224 };
+    static constexpr int maxFrameHeight = 448;
+    PixelFormat pixelFormat = PixelFormat::RGBA8888; // Format of the framebuffers. With Indexed8, the colours are in paletteRAM
 
     std::array <u16, 0x8000> vram; // The VRAM. Note: This is 16-bit addressed, hence why the array is made of u16's. TODO: Put on heap?
+    TileCache tileCache; // Decoded tiles. Anything that writes to VRAM needs to call vramWritten, which invalidates the tiles it touched
     std::array <u16, 256> paletteRAM; // Palette RAM, addressed in words again
-    std::array <u32, 256> paletteCache; // Palettes are converted from BGR555 to RGBA8888 on write, then cached here to be used later by the PPU for speed reasons
-    std::array <u16, 256> scanlineBuffer;
+    std::array <u32, 256> paletteCache; // Palettes are converted from BGR555 to the framebuffer's pixel format on write, then cached here to be used later by the PPU for speed reasons
+    // Each layer is rendered into its own line buffer. Every opaque pixel is tagged with the layer's rank in the current BG mode,
+    // so the main and sub screens can be resolved by keeping the highest tag of each pixel
+    // Tag format: rank << 11 | layer << 8 | CGRAM index. Transparent pixels are 0, which also makes the backdrop show up
+    std::array <std::array <u16, 256>, LayerCount> layerBuffers;
+    std::array <u16, 256> mainScreen;
+    std::array <u16, 256> subScreen;
+    std::array <std::array <u16, 256>, 4> hiresBuffers; // BGs in modes 5 and 6 are 512 pixels wide. layerBuffers holds their odd columns and this the even ones
+
+    // Hi-res and interlace
+    SetIni setini;
+    bool field = false; // Which field of an interlaced frame is being drawn. Odd fields are drawn in the odd rows
+    int frameWidth = 256, frameHeight = 224; // Size of the frame being drawn
+    bool hiresFrame = false; // Did the frame being drawn have any hi-res lines so far?
+
+    // Windows and colour math
+    u8 windowSel[3] = { 0, 0, 0 }; // W12SEL, W34SEL, WOBJSEL. 4 bits per layer (See Windows::combine). The last nibble is the colour window
+    u8 windowPos[4] = { 0, 0, 0, 0 }; // WH0-WH3: Left and right edges of window 1, then window 2
+    u16 windowLogic = 0; // WBGLOG | WOBJLOG << 8. 2 bits per layer, in the same order as windowSel
+    u8 tmw = 0; // Layers masked by their window on the main screen
+    u8 tsw = 0; // Layers masked by their window on the sub screen
+    CGWSel cgwsel;
+    CGADSub cgadsub;
+    u16 fixedColour = 0; // COLDATA, in BGR555
+
+    std::array <LineMask, LayerCount> layerWindows; // Window masks of the current line. Recalculated per line, as HDMA can change them
+    LineMask colourWindow;
+    std::array <u16, 256> lineColours; // Output of colour math, in BGR555
 
     u16 vofs[4] = { 0, 0, 0, 0 };
     u8 old_vofs[4] = { 0, 0, 0, 0 }; // Needed due to how VOFS writes work
@@ -84,9 +182,52 @@ public:
 
     int line = 0; // Line we're currently rendering
 
+    RenderPolicy renderPolicy = RenderPolicy::EveryFrame;
+    int frameInterval = 1; // For RenderPolicy::EveryNthFrame
+    int framesUntilDraw = 0; // How many frames to skip before drawing the next one, with RenderPolicy::EveryNthFrame
+    bool frameRequested = false; // For RenderPolicy::OnRequest
+    bool drawingFrame = true; // Is the current frame being drawn?
+    bool frameDrawn = false; // Was the last finished frame drawn? If not, the framebuffer wasn't touched
+    bool frameChanged = true; // Did any line of the current frame change since the last frame? If not, there's nothing new to display
+
+    // Dirty line tracking. These count up whenever VRAM, CGRAM or OAM actually change, so they can be part of a line's signature
+    u32 vramGeneration = 0, cgramGeneration = 0, oamGeneration = 0;
+    std::array <std::array <LineSignature, maxFrameHeight>, 2> bufferLines; // Signature of the line each framebuffer row holds
+    std::array <LineSignature, 224> lastFrameLines; // Signature of each line in the last frame that got drawn
+
+    // Mode 7 state. The 16-bit mode 7 registers are written twice, low byte first, and all share the same latch for the low byte
+    M7Sel m7sel;
+    s16 m7a = 0, m7b = 0, m7c = 0, m7d = 0; // Transformation matrix, in signed 8.8 fixed point
+    s16 m7x = 0, m7y = 0; // Centre of the transformation (13-bit signed)
+    s16 m7hofs = 0, m7vofs = 0; // Scroll (13-bit signed). Written through BG1HOFS/BG1VOFS
+    u8 m7Latch = 0;
+
+    // OBJ (sprite) state
+    std::array <u8, 544> oam; // 128 4-byte sprite entries, followed by a 32-byte table holding 2 more bits per sprite
+    OBJSel objsel;
+    u16 oamAddress = 0; // The internal OAM byte address. Reloaded from OAMADDR when that's written and at the start of VBlank
+    u8 oamLatch = 0; // Writes to the first 512 bytes of OAM latch even bytes, and write the whole word when the odd byte arrives
+    bool objRangeOver = false; // Was there a line with more than 32 sprites? (STAT77 bit 6)
+    bool objTimeOver = false; // Was there a line with more than 34 sprite tiles? (STAT77 bit 7)
+
+    // Lists of the sprites on each line, in priority order. Rebuilt when OAM or OBJSEL change, so lines don't have to scan all 128 sprites
+    static constexpr int objLineCount = 224;
+    std::array <std::array <u8, 32>, objLineCount> objLines;
+    std::array <u8, objLineCount> objLineSizes;
+    std::array <bool, objLineCount> objLineOverflow; // Were there more than 32 sprites on this line?
+    bool objListsDirty = true;
+
+#ifdef SNES_THREADED_PPU
+    PPURenderThread* renderThread = nullptr; // Draws our lines on another thread. Gets sent every VRAM, CGRAM and OAM write
+#endif
+
     PPU() { // Allocate buffers if they haven't been allocated 
         if (buffers[0] == nullptr) buffers[0] = new u8[256 * 224 * 4]();
         if (buffers[1] == nullptr) buffers[1] = new u8[256 * 224 * 4]();
+
+        for (auto& buffer : bufferLines) // Nothing has been drawn yet, so make sure no row matches any signature
+            buffer.fill (LineSignature::none());
+        lastFrameLines.fill (LineSignature::none());
     }
 
     u16 hcounterLatch = 0; // The latched H-Counter value
@@ -119,9 +260,104 @@ public:
         return val;
     }
 
+    void writeCGDATA (u8 value); // Palettes are written a byte at a time, with the low byte latched until the high byte arrives
+    void writeOAMDATA (u8 value);
+    void writeOAM (u16 address, u8 value); // Write a byte to OAM, if it changes anything
+    void setPalette (u8 index, u16 value); // Write a BGR555 colour to palette RAM and the palette cache
+    void setPixelFormat (PixelFormat format); // Change the framebuffer format. Takes effect from the next line
+    int bytesPerPixel() const { return PixelFormats::bytesPerPixel (pixelFormat); }
+
+    // Write a word to VRAM. Writes that don't change anything are dropped, so they don't make any lines dirty
+    void writeVRAM (u32 address, u16 value) {
+        address &= 0x7FFF;
+        if (vram[address] == value)
+            return;
+
+        vram[address] = value;
+        vramWritten (address);
+    }
+
+    // Anything that writes to VRAM has to call these afterwards, so the tile cache, the render thread and the dirty line tracking see the write
+    void vramWritten (u32 address) {
+        address &= 0x7FFF;
+        tileCache.invalidate (address);
+        vramGeneration++;
+#ifdef SNES_THREADED_PPU
+        logVRAMWrite (address);
+#endif
+    }
+
+    void vramRangeWritten (u32 address, u32 count) { // The range can't wrap around the end of VRAM
+        tileCache.invalidateRange (address, count);
+        vramGeneration++;
+#ifdef SNES_THREADED_PPU
+        for (u32 i = 0; i < count; i++)
+            logVRAMWrite (address + i);
+#endif
+    }
+
+#ifdef SNES_THREADED_PPU
+    void logVRAMWrite (u32 address);
+    void logCGRAMWrite (u8 index);
+    void logOAMWrite (u16 address);
+#endif
+
+    // Write a byte to one of the mode 7 registers, returning the register's new value
+    s16 writeMode7Register (u8 value) {
+        const s16 data = (value << 8) | m7Latch;
+        m7Latch = value;
+        return data;
+    }
+
+    u8 readOAMDATA();
+    void reloadOAMAddress() { oamAddress = (oamaddr.raw & 0x1FF) << 1; }
+
+    PPULineState saveLineState() const;
+    void loadLineState (const PPULineState& state);
+    LineSignature lineSignature() const;
+
+    static void registerMMIO(); // Register the PPU's IO port handlers with the MMIO table
+
+    void setRenderPolicy (RenderPolicy policy, int interval = 1) { // Takes effect from the next frame
+        renderPolicy = policy;
+        frameInterval = std::max (interval, 1);
+        framesUntilDraw = 0;
+    }
+
+    void requestFrame() { frameRequested = true; } // Draw the next frame with RenderPolicy::OnRequest
+
     // Actual rendering stuff
+    void startFrame(); // Called when a new frame starts. Decides if it gets drawn
+    void drawLine(); // Called at the HBlank of every visible line. Renders the line here, or sends it to the render thread
+    void finishFrame(); // Wait until every line of the frame has been rendered
+    bool reuseLine(); // Skip drawing the line if its framebuffer row is already up to date, or can be copied from the other framebuffer
+    void weaveLine(); // Copy the other field's row from the last frame, when drawing an interlaced frame
+    void resizeBuffer (int width, int height); // Resize the framebuffer being drawn. Widening it keeps the rows that were already drawn
+    bool hiresLine() const { return bgmode.mode == 5 || bgmode.mode == 6 || setini.pseudoHires; }
+    int outputRow() const { return frameHeight == maxFrameHeight ? (line * 2 + field) : line; } // Framebuffer row of the current line
     void renderScanline();
+    void writeLine (bool colourMath, bool hires); // Write the finished line to the framebuffer, in its pixel format
+    // Write the 256 pixels of one screen. With colour math, they're taken from its blended colours instead of the palette cache
+    void writeScreen (u8* output, const std::array <u16, 256>& screen, const std::array <u16, 256>& colours, bool colourMath);
+
+    const LayerRanks& layerRanks() const;
 
-    template <Depth depth, int number, RenderPriority priority>
+    template <Depth depth, int number>
     void renderBG();
+
+    template <Depth depth, int number>
+    void renderHiresBG();
+
+    void renderMode7();
+
+    void updateWindows();
+    bool colourMathActive() const;
+    // Blend each pixel of a screen with the other screen or the fixed colour into output
+    // Normally that's the main screen blended with the sub screen, but hi-res lines also blend the sub screen's columns with the main screen
+    void applyColourMath (const std::array <u16, 256>& screen, const std::array <u16, 256>& otherScreen, std::array <u16, 256>& output);
+
+    void buildOBJLists();
+    void evaluateOBJLine (int* tileBudget); // Find how many tiles of each sprite on this line get drawn, and update the overflow flags
+    void updateOBJFlags(); // Update the sprite overflow flags for this line, without drawing anything
+    void renderOBJLine(); // Render this line's sprites into the OBJ line buffer
 };
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "PPU/ppu.hpp"
+#include "spsc_queue.hpp"
+#include "utils.hpp"
+
+// Draws lines on a dedicated thread, so PPU rendering overlaps with CPU emulation
+// The render thread has its own copy of the PPU. The emulation thread sends it every VRAM, CGRAM and OAM write, and a snapshot of the
+// registers at every visible line's HBlank, in order, through a lock-free queue. Since the copy sees the exact same state the PPU had
+// when the line was due, the output is identical to drawing the line on the emulation thread
+class PPURenderThread {
+    enum class CommandType : u8 {
+        WriteVRAM, WriteCGRAM, WriteOAM, DrawLine
+    };
+
+    struct Command {
+        CommandType type;
+        u16 address;
+        u16 value;
+    };
+
+    PPU renderer; // Only ever touched by the render thread after construction
+    SPSCQueue <Command, 1 << 17> commands;
+    SPSCQueue <PPULineState, 256> lines; // Snapshots for DrawLine commands, in the same order
+
+    u64 linesQueued = 0; // Only touched by the emulation thread
+    std::atomic <u64> linesDrawn = 0;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::atomic <bool> sleeping = false;
+    std::atomic <bool> quit = false;
+
+    void run();
+    void push (const Command& command);
+    void wake();
+    bool waitForCommands(); // Returns false if the thread should exit
+
+public:
+    PPURenderThread (const PPU& ppu); // Starts off with a copy of the PPU's state
+    ~PPURenderThread();
+
+    void logVRAMWrite (u16 address, u16 value) { push ({ CommandType::WriteVRAM, address, value }); }
+    void logCGRAMWrite (u8 index, u16 value) { push ({ CommandType::WriteCGRAM, index, value }); }
+    void logOAMWrite (u16 address, u8 value) { push ({ CommandType::WriteOAM, address, value }); }
+
+    void drawLine (const PPU& ppu); // Queue the PPU's current line for drawing
+    void waitIdle(); // Wait until every queued line has been drawn
+    void setBuffers (const PPU& ppu); // Point the render thread to the PPU's framebuffers after they get reallocated. Only call while idle
+};
@@ -0,0 +1,137 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include "utils.hpp"
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+enum class Depth {
+    Bpp2, Bpp4, Bpp8
+};
+
+// Planar to chunky tile decoding
+// SNES tiles are stored as bit-planes: Each row of a tile is made of 2, 4 or 8 bytes, with one bit of every pixel per byte
+// Instead of extracting the pixels one at a time, we decode a whole row at once into a u64, holding one palette index per byte
+// The leftmost pixel of the row is in the lowest byte, so flipping a row horizontally is just a byte swap
+namespace Tiles {
+    // Spread the 8 bits of a bit-plane byte into the bottom bit of each byte of a u64. Bit 7 (the leftmost pixel) goes to byte 0
+    static constexpr std::array <u64, 256> makeSpreadTable() {
+        std::array <u64, 256> table {};
+        for (auto value = 0; value < 256; value++) {
+            for (auto pixel = 0; pixel < 8; pixel++) {
+                if (value & (0x80 >> pixel))
+                    table[value] |= 1ull << (pixel * 8);
+            }
+        }
+
+        return table;
+    }
+
+    inline constexpr auto spreadTable = makeSpreadTable();
+
+    static inline u64 spread (u8 plane) {
+#ifdef __BMI2__ // Deposit each bit into its own byte, then swap the bytes so the MSB is on the left
+        return Helpers::bswap <u64> (_pdep_u64 (plane, 0x0101010101010101ull));
+#else
+        return spreadTable[plane];
+#endif
+    }
+
+    // Decode 2 bit-planes (1 VRAM word). The low byte holds the low bit of each pixel
+    static inline u64 decodePlanePair (u16 planes) {
+        return spread (planes & 0xFF) | (spread (planes >> 8) << 1);
+    }
+
+    // Decode the row of a tile that starts at the given VRAM word address. Returns 8 palette indices, leftmost pixel in the low byte
+    template <Depth depth>
+    static inline u64 decodeRow (const std::array <u16, 0x8000>& vram, u32 address) {
+        u64 row = decodePlanePair (vram[address & 0x7FFF]);
+
+        if constexpr (depth != Depth::Bpp2) // Planes 2 and 3 are 8 words after planes 0 and 1
+            row |= decodePlanePair (vram[(address + 8) & 0x7FFF]) << 2;
+
+        if constexpr (depth == Depth::Bpp8) { // Planes 4-7 are another 16 words after that
+            row |= decodePlanePair (vram[(address + 16) & 0x7FFF]) << 4;
+            row |= decodePlanePair (vram[(address + 24) & 0x7FFF]) << 6;
+        }
+
+        return row;
+    }
+
+    static inline u64 flipRow (u64 row) { return Helpers::bswap <u64> (row); }
+}
+
+// Cache of decoded tiles, keyed by VRAM address and depth. Each tile is stored as 8 decoded rows (See Tiles::decodeRow)
+// Tiles are decoded the first time they're used, and invalidated whenever VRAM is written, so they only get decoded again if they change
+// Tiles are always aligned to their size in VRAM: 8 words for 2bpp tiles, 16 for 4bpp and 32 for 8bpp
+class TileCache {
+    using VRAM = std::array <u16, 0x8000>;
+
+    template <Depth depth>
+    static constexpr int tileShift = depth == Depth::Bpp2 ? 3 : depth == Depth::Bpp4 ? 4 : 5; // log2 (tile size in words)
+
+    template <Depth depth>
+    struct DecodedTiles {
+        std::array <u64, (0x8000 >> tileShift <depth>) * 8> rows;
+        std::array <bool, (0x8000 >> tileShift <depth>)> valid {};
+    };
+
+    DecodedTiles <Depth::Bpp2> tiles2bpp;
+    DecodedTiles <Depth::Bpp4> tiles4bpp;
+    DecodedTiles <Depth::Bpp8> tiles8bpp;
+
+    template <Depth depth>
+    auto& tiles() {
+        if constexpr (depth == Depth::Bpp2) return tiles2bpp;
+        else if constexpr (depth == Depth::Bpp4) return tiles4bpp;
+        else return tiles8bpp;
+    }
+
+public:
+    // Get the 8 decoded rows of the tile starting at the given VRAM word address
+    template <Depth depth>
+    const u64* getTile (const VRAM& vram, u32 address) {
+        auto& cache = tiles <depth>();
+        const auto index = (address & 0x7FFF) >> tileShift <depth>;
+        const auto rows = &cache.rows[index * 8];
+
+        if (!cache.valid[index]) {
+            const auto tileAddress = index << tileShift <depth>;
+            for (auto row = 0; row < 8; row++)
+                rows[row] = Tiles::decodeRow <depth> (vram, tileAddress + row);
+            cache.valid[index] = true;
+        }
+
+        return rows;
+    }
+
+    const u64* getTile (Depth depth, const VRAM& vram, u32 address) {
+        switch (depth) {
+            case Depth::Bpp2: return getTile <Depth::Bpp2> (vram, address);
+            case Depth::Bpp4: return getTile <Depth::Bpp4> (vram, address);
+            default: return getTile <Depth::Bpp8> (vram, address);
+        }
+    }
+
+    // Invalidate every tile that contains the VRAM word at address
+    void invalidate (u32 address) {
+        address &= 0x7FFF;
+        tiles2bpp.valid[address >> 3] = false;
+        tiles4bpp.valid[address >> 4] = false;
+        tiles8bpp.valid[address >> 5] = false;
+    }
+
+    // Same, for count words starting at address. The range can't wrap around the end of VRAM
+    void invalidateRange (u32 address, u32 count) {
+        if (count == 0) return;
+        const auto last = address + count - 1;
+
+        std::fill (&tiles2bpp.valid[address >> 3], &tiles2bpp.valid[last >> 3] + 1, false);
+        std::fill (&tiles4bpp.valid[address >> 4], &tiles4bpp.valid[last >> 4] + 1, false);
+        std::fill (&tiles8bpp.valid[address >> 5], &tiles8bpp.valid[last >> 5] + 1, false);
+    }
+
+    void invalidateAll() { invalidateRange (0, 0x8000); }
+};
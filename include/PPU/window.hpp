@@ -0,0 +1,85 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include "utils.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// A mask over the 256 pixels of a line, 1 bit per pixel. Pixel 0 is bit 0 of the first word
+// Windows are 1 span per line, so they're stored as masks: Combining them is then a few bitwise ops per line instead of per pixel
+using LineMask = std::array <u64, 4>;
+
+namespace Windows {
+    // Mask of the pixels from left to right (inclusive). If left > right, the window is empty
+    static inline LineMask span (int left, int right) {
+        LineMask mask {};
+
+        for (auto word = 0; word < 4; word++) {
+            const int first = std::max (left, word * 64) - word * 64;
+            const int last = std::min (right, word * 64 + 63) - word * 64;
+            if (first <= last)
+                mask[word] = (~0ull >> (63 - last)) & (~0ull << first);
+        }
+
+        return mask;
+    }
+
+    // Combine windows 1 and 2 for a layer
+    // select: Bit 0 = Invert window 1, bit 1 = Enable window 1, bit 2 = Invert window 2, bit 3 = Enable window 2
+    // logic: How to combine them if both are enabled (0 = OR, 1 = AND, 2 = XOR, 3 = XNOR)
+    static inline LineMask combine (const LineMask& window1, const LineMask& window2, unsigned select, unsigned logic) {
+        const bool enable1 = select & 2;
+        const bool enable2 = select & 8;
+        const u64 invert1 = (select & 1) ? ~0ull : 0;
+        const u64 invert2 = (select & 4) ? ~0ull : 0;
+        LineMask mask {};
+
+        for (auto word = 0; word < 4; word++) {
+            const auto a = window1[word] ^ invert1;
+            const auto b = window2[word] ^ invert2;
+
+            if (enable1 && enable2) {
+                switch (logic) {
+                    case 0: mask[word] = a | b; break;
+                    case 1: mask[word] = a & b; break;
+                    case 2: mask[word] = a ^ b; break;
+                    case 3: mask[word] = ~(a ^ b); break;
+                }
+            }
+
+            else if (enable1) mask[word] = a;
+            else if (enable2) mask[word] = b;
+        }
+
+        return mask;
+    }
+
+    // Pick the pixels of a CGWSEL region setting (0 = None, 1 = Outside the window, 2 = Inside the window, 3 = All)
+    static inline LineMask region (unsigned setting, const LineMask& window) {
+        LineMask mask {};
+        for (auto word = 0; word < 4; word++) {
+            switch (setting) {
+                case 1: mask[word] = ~window[word]; break;
+                case 2: mask[word] = window[word]; break;
+                case 3: mask[word] = ~0ull; break;
+            }
+        }
+
+        return mask;
+    }
+
+    static inline bool isEmpty (const LineMask& mask) { return (mask[0] | mask[1] | mask[2] | mask[3]) == 0; }
+
+    // Get the mask bits of 8 pixels starting at x. x has to be a multiple of 8
+    static inline u8 getByte (const LineMask& mask, int x) { return (u8) (mask[x >> 6] >> (x & 63)); }
+
+#ifdef __SSE2__
+    // Expand 8 bits of a mask to 8 16-bit lanes, which are all 1s if the bit is set and 0 otherwise
+    static inline __m128i expand (u8 bits) {
+        const auto select = _mm_setr_epi16 (1, 2, 4, 8, 16, 32, 64, 128);
+        return _mm_cmpeq_epi16 (_mm_and_si128 (_mm_set1_epi16 (bits), select), select);
+    }
+#endif
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "BitField.hpp"
 #include "utils.hpp"
 
@@ -16,6 +17,13 @@ enum class DMADirection {
     IOToCPU
 };
 
+// One HDMA unit transfer, as found by pre-parsing a channel's HDMA table
+struct HDMATransfer {
+    u16 line; // The line this transfer happens before
+    u32 address; // The A-bus address of the unit. Only used for IO -> CPU transfers, as those can't be resolved ahead of time
+    u8 data[4]; // The unit's data, for CPU -> IO transfers
+};
+
 struct DMAChannel {
     uint8_t controlRegs[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
@@ -34,8 +42,32 @@ struct DMAChannel {
     u32 IOAddress() {
         return 0x2100 + controlRegs[1];
     }
+
+    // Write back the A-bus address and byte counter at the end of a transfer. The bank isn't affected
+    void setCurrentAddress (u16 address) {
+        controlRegs[2] = address & 0xFF;
+        controlRegs[3] = address >> 8;
+    }
+
+    void setByteCounter (u16 counter) {
+        controlRegs[5] = counter & 0xFF;
+        controlRegs[6] = counter >> 8;
+    }
+
+    // HDMA state. The channel's table is parsed into a list of transfers at the start of each frame, which is then consumed line by line
+    std::vector <HDMATransfer> hdmaTransfers;
+    size_t hdmaCursor = 0; // Index of the next transfer to run
+
+    void parseHDMATable();
+    void runHDMA (int line);
+
+    static void registerMMIO(); // Register MDMAEN, HDMAEN and the channel control registers with the MMIO table
 };
 
 namespace Memory {
+    extern u8 hdmaen; // Which channels have HDMA enabled
+
     void doGPDMA (int channel);
+    void initHDMA(); // Parse the HDMA tables of all enabled channels and run the transfers for line 0. Called at the start of each frame
+    void doHDMA (int line); // Run the HDMA transfers for a line
 }
\ No newline at end of file
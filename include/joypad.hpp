@@ -5,6 +5,8 @@
 namespace Joypads {
     extern u16 pad1;
 
+    void registerMMIO(); // Register the joypad ports with the MMIO table
+
     const sf::Keyboard::Key keyMappings[] = {
         sf::Keyboard::R, // R
         sf::Keyboard::L, // L
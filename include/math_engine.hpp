@@ -10,9 +10,8 @@ struct MathEngine {
 
     u16 division_remainder_multiplication_product = 0; // The remainder for division, or the product for multiplication
 
-    // Mode 7 multiplication registers
-    bool m7_multiplicand_latch = false; // 1st write: Low 8 bits of multiplicand, 2nd write: upper 8 bits of multiplicand
-    u16 m7_multiplicand = 0;
-    u8 m7_multiplier = 0;
+    // Mode 7 multiplication result. M7A and M7B live in the PPU, as they're also the mode 7 matrix, and update this when written
     u32 m7_product = 0;
+
+    static void registerMMIO(); // Register the multiplication/division ports with the MMIO table
 };
\ No newline at end of file
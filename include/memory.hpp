@@ -27,6 +27,7 @@ namespace Memory {
     extern MathEngine mathEngine; // A math engine that handles the multiplication/division ports and the M7 multiplication port
     extern DMAChannel dmaChannels[8]; // DMA channels
     extern SPC700 apu; // The audio processor
+    extern AudioBuffer audioBuffer; // Samples from the DSP, waiting to be played by the frontend
 
     // System memory
     extern std::array <u8, 128 * kilobyte> wram;
@@ -35,9 +36,11 @@ namespace Memory {
     constexpr unsigned pageSize = 2048; // 2 Kilobyte pages
     constexpr unsigned pageCount = 0x1000000 / pageSize;
 
-    static std::array <uint8_t*, pageCount> pageTableRead; // Page table for reads
-    static std::array <uint8_t*, pageCount> pageTableWrite; // Page table for writes
-    static u32 wramAddress = 0;
+    constexpr unsigned pageMask = pageSize - 1;
+
+    extern std::array <uint8_t*, pageCount> pageTableRead; // Page table for reads
+    extern std::array <uint8_t*, pageCount> pageTableWrite; // Page table for writes
+    extern u32 wramAddress; // WRAM address for WMDATA accesses
 
     void loadROM (std::filesystem::path directory);
     u8 read8 (u32 address); // Memory read handlers
@@ -46,19 +49,40 @@ namespace Memory {
     void write8 (u32 address, u8 value); // Memory write handlers
     void write16 (u32 address, u16 value);
 
+    // Page table-based memory handlers. Without host VM fastmem, the handlers above are just these
+    u8 readPaged8 (u32 address);
+    u16 readPaged16 (u32 address);
+    void writePaged8 (u32 address, u8 value);
+    void writePaged16 (u32 address, u16 value);
+
     template <bool isDebugger = false> // Slow memory handlers for stuff like IO, where fastmem doesn't work
     u8 readSlow (u32 address); 
 
     template <bool isDebugger = false>
     void writeSlow (u32 address, u8 value);
 
-    template <bool isDebugger>
     void writeIO (u16 address, u8 value);
-    
-    static void writeIODMA (u16 address, u8 value) { writeIO <false> (address, value); } // Hack to make the linker happy
+    static void writeIODMA (u16 address, u8 value) { writeIO (address, value); }
+
+    void registerMMIO(); // Register the WRAM port and other miscellaneous registers with the MMIO table
 
     u8 read8Debugger (const u8* buffer, size_t address); // Frontend memory editor functions
     void write8Debugger (u8* buffer, size_t address, u8 data);
 
     void mapFastmemPages();
+    bool isROMPage (u32 address); // Is this address in a page that's fastmem-mapped for reads but not for writes? (IE ROM)
+
+#ifdef SNES_VM_FASTMEM
+    // Host virtual memory fastmem, in vm_fastmem.cpp
+    // The 24-bit bus is mapped into a 16MB host address range, and accesses that fault get sent to the page table-based handlers
+    extern u8* fastmemBase; // Start of the host address range the SNES bus is mapped to
+    void mapVirtualFastmem(); // Map the host address range based on the page tables. Also moves WRAM and ROM into memory we can map
+
+    extern "C" { // Fast accessors. These are written in assembly, so the SIGSEGV handler knows which instructions can fault
+        u8 snesVMRead8 (u32 address);
+        u16 snesVMRead16 (u32 address);
+        void snesVMWrite8 (u32 address, u8 value);
+        void snesVMWrite16 (u32 address, u16 value);
+    }
+#endif
 }; // End Namespace Memory
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+#include <array>
+#include "utils.hpp"
+
+// Table-driven dispatch for memory-mapped IO
+// There's one slot per B-bus register ($2100-$21FF) and per CPU register ($4000-$43FF), and each subsystem registers its own handlers on boot
+// Every slot has a read handler, a side-effect-free "peek" handler used by the debugger, and a write handler. Any of them can be empty,
+// in which case the access falls through to readSlow/writeIO's handling of unmapped addresses
+namespace MMIO {
+    using ReadHandler = u8 (*)(u16 address);
+    using WriteHandler = void (*)(u16 address, u8 value);
+
+    struct Handlers {
+        ReadHandler read = nullptr;
+        ReadHandler peek = nullptr;
+        WriteHandler write = nullptr;
+    };
+
+    constexpr unsigned bBusRegisterCount = 0x100; // $2100-$21FF
+    constexpr unsigned cpuRegisterCount = 0x400; // $4000-$43FF
+    extern std::array <Handlers, bBusRegisterCount + cpuRegisterCount> handlers;
+
+    // Get the slot an IO address belongs to, or -1 if it's not a register we dispatch through the table
+    constexpr int slot (u16 address) {
+        if ((address >> 8) == 0x21)
+            return address & 0xFF;
+        if ((u16) (address - 0x4000) < cpuRegisterCount)
+            return bBusRegisterCount + (address - 0x4000);
+
+        return -1;
+    }
+
+    // Register handlers for the registers in [start, end]
+    // If no peek handler is given, reads are assumed to have no side effects, so the debugger peeks through the read handler
+    void registerRead (u16 start, u16 end, ReadHandler read, ReadHandler peek = nullptr);
+    void registerWrite (u16 start, u16 end, WriteHandler write);
+
+    static void registerRead (u16 address, ReadHandler read, ReadHandler peek = nullptr) { registerRead (address, address, read, peek); }
+    static void registerWrite (u16 address, WriteHandler write) { registerWrite (address, address, write); }
+}
@@ -36,6 +36,7 @@ public:
     std::filesystem::path extension() { return path.extension(); }
     std::filesystem::path filename() { return path.filename(); }
     std::filesystem::path stem() { return path.stem(); }
+    std::filesystem::path filepath() { return path; }
 
     uint8_t* data() { return pointer; }
     
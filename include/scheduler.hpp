@@ -1,7 +1,7 @@
 #pragma once
-#include <functional>
-#include <queue> // For std:priority_queue
-#include <vector> // For std::vector
+#include <array>
+#include <cstdint>
+using u32 = std::uint32_t;
 using u64 = std::uint64_t;
 
 enum class EventTypes {
@@ -29,27 +29,58 @@ struct Event {
     }
 };
 
-// A function to compare 2 events based on their timestamp
-static auto cmp = [](Event left, Event right) {
-    return left.timestamp > right.timestamp;
-};
-
+// The scheduler holds at most one pending event of each type, in a fixed slot indexed by the event type
+// Scheduling an event that's already pending moves it instead of pushing a duplicate, so registers rewritten mid-frame can just reschedule
 class Scheduler {
-    const int MAX_EVENT_NUM = 16; // How many events can the scheduler hold at most?
-    std::priority_queue<Event, std::vector <Event>, decltype(cmp)> events; // Our queue of events
+    static constexpr int MAX_EVENT_NUM = 16; // How many events can the scheduler hold at most?
+    static constexpr int EVENT_TYPE_NUM = (int) EventTypes::Panic + 1;
+    static_assert (EVENT_TYPE_NUM <= MAX_EVENT_NUM, "Too many event types for the scheduler");
+
+    std::array <u64, MAX_EVENT_NUM> timestamps {}; // When each event type is due, if it's pending
+    u32 pendingEvents = 0; // Bitmask of which event types are pending
+    EventTypes nextEventType = EventTypes::Panic; // The type of the next event to fire
+
+    // Find which pending event is due the earliest and cache it, so peeking is O(1)
+    void updateNextEvent() {
+        nextEventTimestamp = UINT64_MAX;
+        nextEventType = EventTypes::Panic;
+        for (int index = 0; index < EVENT_TYPE_NUM; index++) {
+            if (isPending ((EventTypes) index) && timestamps[index] < nextEventTimestamp) {
+                nextEventTimestamp = timestamps[index];
+                nextEventType = (EventTypes) index;
+            }
+        }
+    }
 
 public:
     u64 timestamp = 0; // What cycle are we on?
+    u64 nextEventTimestamp = 0; // The timestamp of the next event. Cached so the CPU can run until it without peeking into the queue
     
-    Event next() { return events.top(); } // Peek next event
-    void removeNext() { events.pop(); }
+    Event next() const { return Event(nextEventType, nextEventTimestamp); } // Peek next event
     void addCycles (u64 cycles) { timestamp += cycles; }
 
+    void removeNext() { cancel (nextEventType); }
+
+    // Schedule an event, moving it if it's already pending
+    // Note: Pushing an event that's earlier than the current deadline makes the CPU stop at it, even if it's in the middle of running a batch
     void pushEvent (EventTypes type, u64 cycle) {
-        events.push (Event(type, cycle));
+        const auto index = (int) type;
+        timestamps[index] = cycle;
+        pendingEvents |= 1 << index;
+        updateNextEvent();
     }
+
+    void reschedule (EventTypes type, u64 cycle) { pushEvent (type, cycle); }
+
+    void cancel (EventTypes type) {
+        pendingEvents &= ~(1 << (int) type);
+        updateNextEvent();
+    }
+
+    bool isPending (EventTypes type) const { return (pendingEvents & (1 << (int) type)) != 0; }
+    u64 timestampOf (EventTypes type) const { return timestamps[(int) type]; } // Only meaningful if the event is pending
     
-    Scheduler() : events(cmp) {
+    Scheduler() {
         pushEvent (EventTypes::HBlank, 1092); // Add first event
         pushEvent (EventTypes::Panic, UINT64_MAX); // A dummy event that's always in the queue
     }
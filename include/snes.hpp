@@ -3,9 +3,14 @@
 #include <condition_variable>
 #include <mutex>
 #include <atomic>
+#include <memory>
+#include <vector>
 #include "utils.hpp"
 #include "CPU/cpu.hpp"
 #include "PPU/ppu.hpp"
+#ifdef SNES_THREADED_PPU
+#include "PPU/render_thread.hpp"
+#endif
 #include "memory.hpp"
 #include "joypad.hpp"
 #include "scheduler.hpp"
@@ -16,18 +21,45 @@ public:
     void step();
     void runFrame();
     void reset();
+    void fireEvents();
+
+    // GPDMA pauses the CPU in the middle of an instruction, so NMIs that come up during a transfer are delayed until it's over
+    void beginDMA() { inDMA = true; }
+    void endDMA();
 
     void runAsync();
     void waitPing(); 
 
+    // Writes from the frontend's VRAM editor get queued up and applied by whoever runs the emulator, before the next frame or step
+    // That way only one thread at a time touches VRAM and the tile cache, and feeds the render thread's command queue
+    void queueVRAMEdit (u32 address, u8 value);
+    void applyVRAMEdits();
+
     CPU cpu;
     PPU ppu;
     Scheduler scheduler;
     bool frameDone = true; // Can we render and go back to the GUI now?
+    bool inDMA = false; // Are we in the middle of a GPDMA?
+    bool nmiDelayed = false; // Did an NMI fire during the current GPDMA?
     
     std::condition_variable emu_condition_variable;
     std::mutex emu_mutex;
     std::atomic <bool> run_emu_thread = false;
+
+#ifdef SNES_THREADED_PPU
+    std::unique_ptr <PPURenderThread> renderThread; // Renders the PPU's lines while we keep emulating
+#endif
+
+private:
+    void fireNMI();
+
+    struct VRAMEdit {
+        u32 address; // Byte address
+        u8 value;
+    };
+
+    std::vector <VRAMEdit> vramEdits;
+    std::mutex vramEditMutex; // The GUI queues edits while the emulator thread is running
 }; // End Namespace SNES
 
 extern SNES g_snes; // a global SNES object
\ No newline at end of file
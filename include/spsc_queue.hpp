@@ -0,0 +1,41 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Lock-free queue with a single producer thread and a single consumer thread
+// The producer only writes tail and the consumer only writes head, so the 2 sides never contend on the same index
+// Size has to be a power of 2, so the indices can count up forever and get masked when accessing the entries
+template <typename T, size_t size>
+class SPSCQueue {
+    static_assert ((size & (size - 1)) == 0, "SPSCQueue size must be a power of 2");
+
+    std::array <T, size> entries;
+    alignas(64) std::atomic <size_t> head = 0; // Next entry to pop
+    alignas(64) std::atomic <size_t> tail = 0; // Next entry to push
+
+public:
+    // Producer side. Returns false if the queue is full
+    bool push (const T& value) {
+        const auto index = tail.load (std::memory_order_relaxed);
+        if (index - head.load (std::memory_order_acquire) == size)
+            return false;
+
+        entries[index & (size - 1)] = value;
+        tail.store (index + 1, std::memory_order_release); // Publish the entry
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty
+    bool pop (T& value) {
+        const auto index = head.load (std::memory_order_relaxed);
+        if (index == tail.load (std::memory_order_acquire))
+            return false;
+
+        value = entries[index & (size - 1)];
+        head.store (index + 1, std::memory_order_release); // Hand the slot back to the producer
+        return true;
+    }
+
+    bool empty() const { return head.load (std::memory_order_acquire) == tail.load (std::memory_order_acquire); }
+};
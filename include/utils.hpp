@@ -3,10 +3,16 @@
 #include <vector>
 #include <fstream>
 #include <utility>     // For std::pair, used by loadROMWithHash
+#include <cstring>     // For std::memcpy, used by readLE/writeLE
 #include "sha1.hpp"    // For calculating SHA hashes, used by loadROMWithHash
 #include "fmt/format.h" // Core fmt functions
 #include "fmt/color.h"  // Text coloring fmt functions
 
+// Threaded dispatch (SNES_THREADED_DISPATCH) uses computed gotos where the compiler supports labels as values, and handler tables elsewhere
+#if defined(SNES_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define SNES_COMPUTED_GOTO
+#endif
+
 using u8 = std::uint8_t;
 using u16 = std::uint16_t;
 using u32 = std::uint32_t;
@@ -173,6 +179,21 @@ namespace Helpers {
         *(T*)pointer = bswap(value);
     }
 
+    // Unaligned little endian accesses, used by the fastmem paths
+    template <typename T>
+    T readLE (const u8* pointer) {
+        // TODO: Detect and support big endian systems
+        T value;
+        std::memcpy (&value, pointer, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void writeLE (u8* pointer, T value) {
+        // TODO: Detect and support big endian systems
+        std::memcpy (pointer, &value, sizeof(T));
+    }
+
     constexpr u8 get8BitColor (u8 color5) {
         return (color5 << 3) | (color5 >> 2);
     }
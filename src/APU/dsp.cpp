@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <cmath>
+#include "APU/dsp.hpp"
+#include "memory.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+    constexpr int counterRange = 2048 * 5 * 3; // The global counter's period. Every rate's period divides it
+
+    // How many samples pass between envelope or noise events at each rate, and the counter values they line up with. Rate 0 never fires
+    constexpr int counterRates[32] = {
+        counterRange + 1, 2048, 1536, 1280, 1024, 768, 640, 512, 384, 320, 256, 192, 160, 128, 96, 80,
+        64, 48, 40, 32, 24, 20, 16, 12, 10, 8, 6, 5, 4, 3, 2, 1
+    };
+
+    constexpr int counterOffsets[32] = {
+        1, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536,
+        0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 0, 0
+    };
+
+    // The 512 entry table the DSP's Gaussian interpolation uses. Rather than storing the hardware's table, we generate a windowed sinc that matches it,
+    // then scale every group of 4 weights used together so they add up to 2048
+    std::array <s16, 512> makeGaussTable() {
+        constexpr double pi = 3.14159265358979323846;
+        std::array <double, 512> curve;
+        std::array <s16, 512> table;
+
+        for (auto n = 0; n < 512; n++) {
+            const double k = 0.5 + n;
+            const double s = std::sin (pi * k * 1.280 / 1024);
+            const double t = (std::cos (pi * k * 2.000 / 1023) - 1) * 0.50;
+            const double u = (std::cos (pi * k * 4.000 / 1023) - 1) * 0.08;
+            curve[511 - n] = s * (t + u + 1.0) / k;
+        }
+
+        for (auto phase = 0; phase < 128; phase++) {
+            const int taps[4] = { phase, phase + 256, 511 - phase, 255 - phase };
+            double sum = 0.0;
+            for (auto tap : taps)
+                sum += curve[tap];
+
+            const double scale = 2048.0 / sum;
+            for (auto tap : taps)
+                table[tap] = (s16) (curve[tap] * scale + 0.5);
+        }
+
+        return table;
+    }
+
+    const auto gaussTable = makeGaussTable();
+
+    s16 clamp16 (int value) { return (s16) std::clamp (value, -32768, 32767); }
+
+    // Expand the 16 nibbles of a BRR block into samples, applying the block's shift but not its filter
+    // Nibbles are signed, and the high nibble of each byte comes first. Shifts of 13-15 are invalid, and give -2048 or 0 depending on the sign
+    void expandNibbles (const u8* data, int shift, s16* output) {
+#ifdef __SSE2__
+        // Put every nibble in the top 4 bits of a 16-bit lane, so it becomes (nibble << 12) as a signed number
+        // Then (nibble << shift) >> 1 is an arithmetic right shift by 13 - shift
+        const auto bytes = _mm_loadl_epi64 ((const __m128i*) data);
+        const auto high = _mm_and_si128 (bytes, _mm_set1_epi8 ((char) 0xF0));
+        const auto low = _mm_slli_epi16 (_mm_and_si128 (bytes, _mm_set1_epi8 (0x0F)), 4); // Doesn't cross bytes, as the high nibbles were masked out
+        const auto nibbles = _mm_unpacklo_epi8 (high, low);
+
+        auto first = _mm_unpacklo_epi8 (_mm_setzero_si128(), nibbles);
+        auto second = _mm_unpackhi_epi8 (_mm_setzero_si128(), nibbles);
+
+        if (shift <= 12) {
+            const auto count = _mm_cvtsi32_si128 (13 - shift);
+            first = _mm_sra_epi16 (first, count);
+            second = _mm_sra_epi16 (second, count);
+        } else {
+            first = _mm_slli_epi16 (_mm_srai_epi16 (first, 15), 11);
+            second = _mm_slli_epi16 (_mm_srai_epi16 (second, 15), 11);
+        }
+
+        _mm_storeu_si128 ((__m128i*) &output[0], first);
+        _mm_storeu_si128 ((__m128i*) &output[8], second);
+#else
+        for (auto i = 0; i < 16; i++) {
+            const u8 byte = data[i >> 1];
+            const int nibble = (s16) (((i & 1) ? byte : (byte >> 4)) << 12) >> 12;
+
+            output[i] = (shift <= 12) ? (s16) ((nibble << shift) >> 1) : (nibble < 0 ? -2048 : 0);
+        }
+#endif
+    }
+
+    // Sum (samples[i] * weights[i]) >> shift over 8 lanes. Used for the voice mix, where the weights are volumes, and the echo FIR
+#ifdef __SSE2__
+    template <int shift>
+    int weightedSum (__m128i samples, __m128i weights) {
+        const auto low = _mm_mullo_epi16 (samples, weights);
+        const auto high = _mm_mulhi_epi16 (samples, weights);
+
+        auto sum = _mm_add_epi32 (_mm_srai_epi32 (_mm_unpacklo_epi16 (low, high), shift), _mm_srai_epi32 (_mm_unpackhi_epi16 (low, high), shift));
+        sum = _mm_add_epi32 (sum, _mm_shuffle_epi32 (sum, _MM_SHUFFLE (1, 0, 3, 2)));
+        sum = _mm_add_epi32 (sum, _mm_shuffle_epi32 (sum, _MM_SHUFFLE (2, 3, 0, 1)));
+        return _mm_cvtsi128_si32 (sum);
+    }
+#endif
+
+    template <int shift>
+    int weightedSum (const s16* samples, const s16* weights) {
+#ifdef __SSE2__
+        return weightedSum <shift> (_mm_loadu_si128 ((const __m128i*) samples), _mm_loadu_si128 ((const __m128i*) weights));
+#else
+        int sum = 0;
+        for (auto i = 0; i < 8; i++)
+            sum += (samples[i] * weights[i]) >> shift;
+
+        return sum;
+#endif
+    }
+
+    // Run the 8-tap echo FIR filter. taps[0] is the oldest sample. The first 7 taps are summed with 16-bit wraparound, and only the last one is clamped
+    s16 runFIR (const s16* taps, const s16* coefficients) {
+        alignas(16) s16 firstSeven[8];
+        std::copy (coefficients, coefficients + 8, firstSeven);
+        firstSeven[7] = 0;
+
+        int sum = (s16) weightedSum <6> (taps, firstSeven);
+        sum += (s16) ((taps[7] * coefficients[7]) >> 6);
+
+        return clamp16 (sum) & ~1;
+    }
+}
+
+void DSP::write (u8 address, u8 value) {
+    if (address >= 0x80) // The mirrors at $80-$FF are read-only
+        return;
+
+    switch (address) {
+        case KeyOn: pendingKeyOn = value; break;
+        case EndX: value = 0; break; // Writing ENDX clears all of its bits
+    }
+
+    regs[address] = value;
+}
+
+bool DSP::counterFired (int rate) const {
+    return ((counter + counterOffsets[rate]) % counterRates[rate]) == 0;
+}
+
+void DSP::keyOnVoice (Voice& voice, int index, const u8* ram) {
+    const u16 entry = (regs[SourceDirectory] << 8) + voiceReg (index, Source) * 4; // Each directory entry has the start and loop addresses of a sample
+    voice.blockAddress = ram[entry] | (ram[(u16) (entry + 1)] << 8);
+
+    voice.samples.fill (0);
+    voice.position = 0;
+    voice.keyOnDelay = 5;
+    voice.envelope = voice.hiddenEnvelope = 0;
+    voice.mode = EnvelopeMode::Attack;
+    regs[EndX] &= ~(1 << index);
+
+    decodeBlock (voice, ram);
+}
+
+// Decode a 9 byte BRR block: A header byte with the shift, filter, loop and end flags, then 16 4-bit samples
+// Expanding the nibbles is vectorized, but the filters feed each sample into the next one, so they run a sample at a time
+void DSP::decodeBlock (Voice& voice, const u8* ram) {
+    std::copy (voice.samples.end() - 3, voice.samples.end(), voice.samples.begin()); // Keep the previous block's last 3 samples for interpolation
+
+    u8 data[8];
+    voice.header = ram[voice.blockAddress];
+    for (auto i = 0; i < 8; i++)
+        data[i] = ram[(u16) (voice.blockAddress + 1 + i)];
+
+    alignas(16) s16 expanded[16];
+    expandNibbles (data, voice.header >> 4, expanded);
+
+    const int filter = (voice.header >> 2) & 3;
+    int p1 = voice.samples[2];
+    int p2 = voice.samples[1];
+
+    for (auto i = 0; i < 16; i++) {
+        int sample = expanded[i];
+
+        switch (filter) { // The samples we store are doubled, and p2 is halved before use
+            case 1: sample += (p1 >> 1) + ((-p1) >> 5); break; // s + p1 * 15/16
+            case 2: sample += p1 - (p2 >> 1) + ((p2 >> 1) >> 4) + ((p1 * -3) >> 6); break; // s + p1 * 61/32 - p2 * 15/16
+            case 3: sample += p1 - (p2 >> 1) + ((p1 * -13) >> 7) + (((p2 >> 1) * 3) >> 4); break; // s + p1 * 115/64 - p2 * 13/16
+        }
+
+        const s16 result = (s16) (clamp16 (sample) * 2); // Samples are 15-bit, and wrap around when doubled
+        voice.samples[3 + i] = result;
+        p2 = p1;
+        p1 = result;
+    }
+}
+
+s16 DSP::interpolate (const Voice& voice) const {
+    const auto offset = (voice.position >> 4) & 0xFF;
+    const s16* forward = &gaussTable[255 - offset];
+    const s16* reverse = &gaussTable[offset];
+    const s16* input = &voice.samples[voice.position >> 12]; // The 4 samples before the current position, oldest first
+
+    int output = (forward[0] * input[0]) >> 11;
+    output += (forward[256] * input[1]) >> 11;
+    output += (reverse[256] * input[2]) >> 11;
+    output = (s16) output; // The first 3 taps wrap around instead of clamping
+    output += (reverse[0] * input[3]) >> 11;
+
+    return clamp16 (output) & ~1;
+}
+
+void DSP::runEnvelope (Voice& voice, int index) {
+    int envelope = voice.envelope;
+
+    if (voice.mode == EnvelopeMode::Release) { // Release goes down by 8 every sample, regardless of the rate
+        voice.envelope = std::max (envelope - 8, 0);
+        return;
+    }
+
+    const u8 adsr1 = voiceReg (index, ADSR1);
+    int data = voiceReg (index, ADSR2);
+    int rate;
+
+    if (adsr1 & 0x80) { // ADSR
+        if (voice.mode == EnvelopeMode::Attack) {
+            rate = (adsr1 & 0xF) * 2 + 1;
+            envelope += rate < 31 ? 0x20 : 0x400;
+        } else { // Decay and sustain are exponential
+            envelope--;
+            envelope -= envelope >> 8;
+            rate = (voice.mode == EnvelopeMode::Decay) ? (((adsr1 >> 3) & 0xE) + 0x10) : (data & 0x1F);
+        }
+    }
+
+    else { // GAIN
+        data = voiceReg (index, Gain);
+        const auto mode = data >> 5;
+
+        if (mode < 4) { // Direct
+            envelope = data * 0x10;
+            rate = 31;
+        } else {
+            rate = data & 0x1F;
+            switch (mode) {
+                case 4: envelope -= 0x20; break; // Linear decrease
+                case 5: envelope--; envelope -= envelope >> 8; break; // Exponential decrease
+                case 6: envelope += 0x20; break; // Linear increase
+                case 7: envelope += (voice.hiddenEnvelope >= 0x600) ? 0x8 : 0x20; break; // Bent line increase
+            }
+        }
+    }
+
+    if (voice.mode == EnvelopeMode::Decay && (envelope >> 8) == (data >> 5)) // Decay ends at the sustain level
+        voice.mode = EnvelopeMode::Sustain;
+
+    voice.hiddenEnvelope = envelope;
+    if (envelope < 0 || envelope > 0x7FF) {
+        envelope = envelope < 0 ? 0 : 0x7FF;
+        if (voice.mode == EnvelopeMode::Attack)
+            voice.mode = EnvelopeMode::Decay;
+    }
+
+    if (counterFired (rate)) // The mode changes above happen every sample, but the envelope only changes at the rate's pace
+        voice.envelope = envelope;
+}
+
+// Read a sample from the echo buffer and run it through the FIR filter. Then write the echo input back, mixed with the filter's output for feedback
+StereoSample DSP::runEcho (StereoSample main, StereoSample echoInput, u8* ram) {
+    if (echoOffset == 0)
+        echoLength = (regs[EchoDelay] & 0xF) * 0x800; // 2KB (16ms) per step
+
+    const u16 address = (regs[EchoStart] << 8) + echoOffset;
+    const auto readEcho = [&] (u16 addr) { return (s16) (ram[addr] | (ram[(u16) (addr + 1)] << 8)) >> 1; };
+
+    echoHistoryPos = (echoHistoryPos + 1) & 7;
+    echoHistoryLeft[echoHistoryPos] = echoHistoryLeft[echoHistoryPos + 8] = readEcho (address);
+    echoHistoryRight[echoHistoryPos] = echoHistoryRight[echoHistoryPos + 8] = readEcho (address + 2);
+
+    alignas(16) s16 coefficients[8];
+    for (auto i = 0; i < 8; i++)
+        coefficients[i] = (s8) regs[FIR | (i << 4)];
+
+    const auto echoLeft = runFIR (&echoHistoryLeft[echoHistoryPos + 1], coefficients);
+    const auto echoRight = runFIR (&echoHistoryRight[echoHistoryPos + 1], coefficients);
+
+    const auto mix = [&] (s16 sample, s16 echo, Register volume, Register echoVolume) {
+        return clamp16 (((sample * (s8) regs[volume]) >> 7) + ((echo * (s8) regs[echoVolume]) >> 7));
+    };
+
+    const StereoSample output = {
+        mix (main.left, echoLeft, MainVolumeLeft, EchoVolumeLeft),
+        mix (main.right, echoRight, MainVolumeRight, EchoVolumeRight)
+    };
+
+    if (!(regs[Flags] & 0x20)) { // FLG bit 5 disables echo writes
+        const auto feedback = (s8) regs[EchoFeedback];
+        const auto writeEcho = [&] (u16 addr, s16 input, s16 echo) {
+            const s16 sample = clamp16 (input + ((echo * feedback) >> 7)) & ~1;
+            ram[addr] = sample & 0xFF;
+            ram[(u16) (addr + 1)] = sample >> 8;
+        };
+
+        writeEcho (address, echoInput.left, echoLeft);
+        writeEcho (address + 2, echoInput.right, echoRight);
+    }
+
+    echoOffset += 4;
+    if (echoOffset >= echoLength)
+        echoOffset = 0;
+
+    return output;
+}
+
+void DSP::step (u8* ram) {
+    if (--counter < 0)
+        counter = counterRange - 1;
+
+    const u8 flags = regs[Flags];
+    if (counterFired (flags & 0x1F)) { // Clock the noise generator
+        const int feedback = (noise << 13) ^ (noise << 14);
+        noise = (feedback & 0x4000) ^ (noise >> 1);
+    }
+
+    // Key on and key off are only checked every other sample
+    everyOtherSample = !everyOtherSample;
+    u8 keyOn = 0;
+    if (everyOtherSample) {
+        keyOn = pendingKeyOn;
+        pendingKeyOn = 0;
+    }
+
+    alignas(16) s16 outputs[8];
+    alignas(16) s16 volumesLeft[8];
+    alignas(16) s16 volumesRight[8];
+    alignas(16) s16 echoMask[8];
+
+    for (auto i = 0; i < 8; i++) {
+        auto& voice = voices[i];
+        const u8 bit = 1 << i;
+        const u8 base = i << 4;
+
+        volumesLeft[i] = (s8) regs[base | VolumeLeft];
+        volumesRight[i] = (s8) regs[base | VolumeRight];
+        echoMask[i] = (regs[EchoEnable] & bit) ? -1 : 0;
+
+        if (everyOtherSample) {
+            if (keyOn & bit) keyOnVoice (voice, i, ram);
+            if (regs[KeyOff] & bit) voice.mode = EnvelopeMode::Release;
+        }
+
+        if (flags & 0x80) { // Soft reset silences every voice
+            voice.mode = EnvelopeMode::Release;
+            voice.envelope = 0;
+        }
+
+        if (voice.keyOnDelay != 0) {
+            voice.keyOnDelay--;
+            outputs[i] = voice.output = 0;
+            regs[base | EnvelopeX] = regs[base | OutputX] = 0;
+            continue;
+        }
+
+        const s16 sample = (regs[NoiseEnable] & bit) ? (s16) (noise * 2) : interpolate (voice);
+        outputs[i] = voice.output = ((sample * voice.envelope) >> 11) & ~1;
+        regs[base | EnvelopeX] = voice.envelope >> 4;
+        regs[base | OutputX] = voice.output >> 8;
+
+        runEnvelope (voice, i);
+
+        // Advance through the sample. Pitch modulation scales the pitch by the previous voice's output
+        int pitch = ((regs[base | PitchHigh] & 0x3F) << 8) | regs[base | PitchLow];
+        if (i != 0 && (regs[PitchModulation] & bit))
+            pitch += ((voices[i - 1].output >> 5) * pitch) >> 10;
+
+        voice.position += std::min (pitch, 0x7FFF);
+        if ((voice.position >> 12) >= 16) { // Move on to the next block, which never takes more than 1 step as the pitch is capped below 8 samples
+            voice.position -= 16 << 12;
+
+            if (voice.header & 1) { // The end flag jumps to the loop address. If the loop flag isn't set, the voice is silenced too
+                const u16 entry = (regs[SourceDirectory] << 8) + regs[base | Source] * 4 + 2;
+                voice.blockAddress = ram[entry] | (ram[(u16) (entry + 1)] << 8);
+                regs[EndX] |= bit;
+
+                if (!(voice.header & 2)) {
+                    voice.mode = EnvelopeMode::Release;
+                    voice.envelope = 0;
+                }
+            } else
+                voice.blockAddress += 9;
+
+            decodeBlock (voice, ram);
+        }
+    }
+
+    // Mix the voices into the main output and the echo input
+    // Hardware clamps the running sum after every voice, we only clamp the total. They only differ if the mix overflows midway
+    alignas(16) s16 echoOutputs[8];
+    for (auto i = 0; i < 8; i++)
+        echoOutputs[i] = outputs[i] & echoMask[i];
+
+    const StereoSample main = { clamp16 (weightedSum <7> (outputs, volumesLeft)), clamp16 (weightedSum <7> (outputs, volumesRight)) };
+    const StereoSample echoInput = { clamp16 (weightedSum <7> (echoOutputs, volumesLeft)), clamp16 (weightedSum <7> (echoOutputs, volumesRight)) };
+
+    auto output = runEcho (main, echoInput, ram);
+    if (flags & 0x40) // Muted
+        output = { 0, 0 };
+
+    Memory::audioBuffer.push (output); // If the frontend isn't keeping up, the sample gets dropped
+}
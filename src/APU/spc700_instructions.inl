@@ -553,4 +553,85 @@ void brk() {
 
     psw.breakFlag = true;
     psw.interruptEnable = false;
-}
\ No newline at end of file
+}
+// mov (dd), (ds)
+void mov_dp_dp() {
+    const auto source = getOperand <SPC_Operands::Direct_byte>();
+    const auto destAddress = getAddress <SPC_AddressingModes::Direct>(); 
+    write (destAddress, source);
+}
+
+// OR1 c, mem, bit and OR1 c, !mem, bit
+template <bool inverted>
+void or1() {
+    const auto imm = nextWord();
+
+    const auto bit = imm >> 13; // Top 3 bits of imm are a bit index
+    const auto val = read (imm & 0x1FFF); // Low 13 bits of immediate are a memory address
+    psw.carry = psw.carry || (Helpers::isBitSet(val, bit) != inverted);
+}
+
+// AND1 c, mem, bit and AND1 c, !mem, bit
+template <bool inverted>
+void and1() {
+    const auto imm = nextWord();
+
+    if (psw.carry) {
+        const auto bit = imm >> 13; // Top 3 bits of imm are a bit index
+        const auto val = read (imm & 0x1FFF); // Low 13 bits of immediate are a memory address
+        psw.carry = Helpers::isBitSet(val, bit) != inverted;
+    }
+}
+
+// EOR1 c, mem, bit
+void eor1() {
+    const auto imm = nextWord();
+    const auto bit = imm >> 13; // Top 3 bits of imm are a bit index
+    const auto val = read (imm & 0x1FFF); // Low 13 bits of immediate are a memory address
+
+    if (Helpers::isBitSet(val, bit)) 
+        psw.carry = !psw.carry;
+}
+
+// MOV1 c, mem, bit
+void mov1() {
+    const auto imm = nextWord();
+    const auto bit = imm >> 13; // Top 3 bits of imm are a bit index
+    const auto val = read (imm & 0x1FFF); // Low 13 bits of immediate are a memory address
+
+    psw.carry = Helpers::isBitSet (val, bit);
+}
+
+// Decimal adjust for subtraction
+void das() {
+    if (!psw.carry || a > 0x99) {
+        a -= 0x60;
+        psw.carry = false;
+    }
+
+    if (!psw.halfCarry || ((a & 0xF) > 9))
+        a -= 6;
+    
+    setNZ (a);
+}
+
+// Decimal adjust for addition
+void daa() {
+    if (psw.carry || a > 0x99) {
+        a += 0x60;
+        psw.carry = true;
+    }
+
+    if (psw.halfCarry || ((a & 0xF) > 9))
+        a += 6;
+
+    setNZ (a);
+}
+
+void hang (u8 opcode) { // Sleep and stop
+    Helpers::panic ("[SPC700] Hanging SPC instruction {} at PC: {:04X}\n", opcode, pc - 1);
+}
+
+void unimplemented (u8 opcode) {
+    Helpers::panic ("[SPC700] Unimplemented opcode: {:02X}\n", opcode);
+}
@@ -1,4 +1,6 @@
 #include "APU/spc700.hpp"
+#include "memory.hpp"
+#include "mmio.hpp"
 #include "utils.hpp"
 
 u8 SPC700::read (u16 address) {
@@ -6,7 +8,9 @@ u8 SPC700::read (u16 address) {
         switch (address) {
             case 0xF0: case 0xF1: case 0xFA: case 0xFB: case 0xFC: return 0; // Write-only
             case 0xF2: return dspRegisterIndex;  // DSP register index
-            case 0xF3: Helpers::warn ("[SPC700] Read from DSP data   PC: {:02X}\nDSP Register: {:02X}\n", pc, dspRegisterIndex); return 0;
+            case 0xF3: // DSP register data. Catch the DSP up first, as ENVX, OUTX and ENDX change as it runs
+                dsp.runUntil (cycles, ram.data());
+                return dsp.read (dspRegisterIndex);
 
             case 0xF4: return inputPorts[0]; // CPU -> SPC communication input ports. The CPU writes here, the SPC reads from here
             case 0xF5: return inputPorts[1];
@@ -68,7 +72,10 @@ void SPC700::write (u16 address, u8 value) {
                 break;
 
             case 0xF2: dspRegisterIndex = value; break;
-            case 0xF3: break; // DSP register data. We currently don't emulate the DSP :(
+            case 0xF3: // DSP register data
+                dsp.runUntil (cycles, ram.data());
+                dsp.write (dspRegisterIndex, value);
+                break;
 
             case 0xF4: outputPorts[0] = value; break;  // CPU -> SPC communication output ports. The SPC writes here, the CPU reads from here
             case 0xF5: outputPorts[1] = value; break;
@@ -103,4 +110,20 @@ void SPC700::write (u16 address, u8 value) {
 void SPC700::write16 (u16 address, u16 value) {
     write (address, value & 0xFF);
     write (address + 1, value >> 8);
-}
\ No newline at end of file
+}
+
+// The CPU side of the APU ports. As the SPC700 runs in parallel with the CPU, we catch it up on every access
+void SPC700::registerMMIO() {
+    MMIO::registerRead (0x2140, 0x2143,
+        [] (u16 address) -> u8 {
+            Memory::apu.catchUp (Memory::scheduler->timestamp); // Run the SPC until the current timestamp
+            return Memory::apu.outputPorts[address & 3]; // Return the value of the appropriate IO port
+        },
+        [] (u16 address) -> u8 { return Memory::apu.outputPorts[address & 3]; }
+    );
+
+    MMIO::registerWrite (0x2140, 0x2143, [] (u16 address, u8 value) {
+        Memory::apu.catchUp (Memory::scheduler->timestamp);
+        Memory::apu.inputPorts[address & 3] = value; // Write to the SPC port
+    });
+}
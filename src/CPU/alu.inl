@@ -6,8 +6,8 @@ void bit() {
         const auto addr = getAddress <addrMode, u8, AccessTypes::Read>();
         const auto val = Memory::read8 (addr);
 
-        psw.zero = (a.al & val) == 0;
-        psw.sign = val >> 7;
+        zeroResult = a.al & val;
+        signResult = val << 8;
         psw.overflow = (val >> 6) & 1; // Set V depending on bit 6
     }
 
@@ -15,20 +15,20 @@ void bit() {
         const auto addr = getAddress <addrMode, u16, AccessTypes::Read>();
         const auto val = Memory::read16 (addr);
 
-        psw.zero = (a.raw & val) == 0;
-        psw.sign = val >> 15;
+        zeroResult = a.raw & val;
+        signResult = val;
         psw.overflow = (val >> 14) & 1; // Set V depending on bit 14
     }
 }
 
 void bit_imm() { // Note: BIT #imm has completely different behavior from the other addressing modes
     if (psw.shortAccumulator) {
-        psw.zero = (a.al & nextByte()) == 0;
+        zeroResult = a.al & nextByte();
         cycles = 2;
     }
     
     else {
-        psw.zero = (a.raw & nextWord()) == 0;
+        zeroResult = a.raw & nextWord();
         cycles = 3;
     }
 }
@@ -39,7 +39,7 @@ void trb() {
         const auto addr = getAddress <addrMode, u8, AccessTypes::RMW>();
         const auto val = Memory::read8 (addr);
 
-        psw.zero = (a.al & val) == 0;
+        zeroResult = a.al & val;
         const auto res = (~a.al) & 0xFF & val;
         Memory::write8 (addr, res);
     }
@@ -48,7 +48,7 @@ void trb() {
         const auto addr = getAddress <addrMode, u16, AccessTypes::RMW>();
         const auto val = Memory::read16 (addr);
 
-        psw.zero = (a.raw & val) == 0;
+        zeroResult = a.raw & val;
         const auto res = (~a.raw) & val;
         Memory::write16 (addr, res);
     }
@@ -60,7 +60,7 @@ void tsb() {
         const auto addr = getAddress <addrMode, u8, AccessTypes::RMW>();
         const auto val = Memory::read8 (addr);
 
-        psw.zero = (a.al & val) == 0;
+        zeroResult = a.al & val;
         const auto res = a.al | val;
         Memory::write8 (addr, res);
     }
@@ -69,7 +69,7 @@ void tsb() {
         const auto addr = getAddress <addrMode, u16, AccessTypes::RMW>();
         const auto val = Memory::read16 (addr);
 
-        psw.zero = (a.raw & val) == 0;
+        zeroResult = a.raw & val;
         const auto res = a.raw | val;
         Memory::write16 (addr, res);
     }
@@ -4,6 +4,10 @@ void relativeJump (bool condition) {
     const auto displacement = (s8) nextByte();
 
     if (condition) {
+        // Short backwards branches are usually loops polling for something. If nothing can change before the next event, skip straight to it
+        if (displacement < 0 && displacement >= -maxIdleLoopSize && skipIdleLoops && isIdleLoop (pc + displacement, pc - 2))
+            skipToNextEvent (3);
+
         pc += displacement;
         cycles = 3;
     }
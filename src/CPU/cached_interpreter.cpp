@@ -0,0 +1,213 @@
+#include "CPU/cpu.hpp"
+#include "CPU/cached_interpreter.hpp"
+#include "CPU/opcodes.hpp"
+
+const std::array <CachedInterpreter::Handler, 256> CachedInterpreter::handlers[4] = {
+    #define OP(number, implementation) &CachedInterpreter::runInstruction <number, false, false>,
+    { CPU_OPCODES(OP) },
+    #undef OP
+    #define OP(number, implementation) &CachedInterpreter::runInstruction <number, false, true>,
+    { CPU_OPCODES(OP) },
+    #undef OP
+    #define OP(number, implementation) &CachedInterpreter::runInstruction <number, true, false>,
+    { CPU_OPCODES(OP) },
+    #undef OP
+    #define OP(number, implementation) &CachedInterpreter::runInstruction <number, true, true>,
+    { CPU_OPCODES(OP) },
+    #undef OP
+};
+
+void CachedInterpreter::flush() {
+    for (auto& set : pages) {
+        for (auto& page : set)
+            page.reset();
+    }
+}
+
+u32 CachedInterpreter::runBlock (CPU& cpu) {
+    const bool shortAccumulator = cpu.psw.shortAccumulator;
+    const bool shortIndex = cpu.psw.shortIndex;
+    const u32 address = ((u32) cpu.pb << 16) | cpu.pc;
+
+    auto& page = pages[(shortAccumulator << 1) | shortIndex][address >> 11];
+    if (!page)
+        page = std::make_unique <CachedPage>();
+
+    auto index = page->blockStart[address & 0x7FF];
+    if (index == 0) // Decode the block if we haven't already
+        index = decodeBlock (*page, address, shortAccumulator, shortIndex);
+
+    const auto scheduler = Memory::scheduler;
+    u32 cycles = 0;
+
+    for (auto instruction = &page->instructions[index - 1]; ; instruction++) {
+        cpu.blockCycles = cycles; // So idle loop skips and WAI know how far behind the scheduler is
+        cycles += instruction->handler (cpu, *instruction);
+
+        // Stop at the end of the block, or once we've reached the next event so it doesn't fire late
+        // The deadline is re-read every time, as IO writes can schedule earlier events. If we stop midway, the rest of the block gets decoded as a block of its own
+        if (instruction->endsBlock || scheduler->timestamp + (u64) cycles * 6 >= scheduler->nextEventTimestamp)
+            break;
+    }
+
+    cpu.blockCycles = 0;
+    return cycles;
+}
+
+u32 CachedInterpreter::decodeBlock (CachedPage& page, u32 address, bool shortAccumulator, bool shortIndex) {
+    const u32 bank = address & 0xFF0000;
+    const auto pageNumber = address >> 11;
+    const u32 index = page.instructions.size() + 1;
+    const auto& handlerSet = handlers[(shortAccumulator << 1) | shortIndex];
+    u16 pc = (u16) address;
+
+    for (auto i = 0; i < maxBlockSize; i++) {
+        const auto opcode = Memory::read8 (bank | pc);
+        const auto length = instructionLength (opcode, shortAccumulator, shortIndex);
+
+        u32 operand = 0;
+        for (auto byte = 1; byte < length; byte++)
+            operand |= Memory::read8 (bank | (u16) (pc + byte)) << ((byte - 1) * 8);
+
+        // An operand that spills into the next page might not be in ROM, so that instruction has to fetch it when it runs
+        const bool operandInPage = ((bank | (u16) (pc + length - 1)) >> 11) == pageNumber;
+        const auto handler = operandInPage ? handlerSet[opcode] : &CachedInterpreter::runInterpreted;
+        pc += length;
+
+        // Stop at control flow, at the end of the page (as the next page might not be ROM), or if the block is full
+        const bool last = endsBasicBlock (opcode) || ((bank | pc) >> 11) != pageNumber || i == maxBlockSize - 1;
+        const auto cycles = baseCycles (simpleInstruction (opcode), shortAccumulator, shortIndex);
+        page.instructions.push_back ({ handler, operand, opcode, (u8) length, (u8) cycles, last });
+
+        if (last)
+            break;
+    }
+
+    page.blockStart[address & 0x7FF] = index;
+    return index;
+}
+
+u32 CachedInterpreter::runInterpreted (CPU& cpu, const DecodedInstruction& instruction) {
+    return CPU::opcodeHandlers[instruction.opcode] (cpu);
+}
+
+// Compute the effective address of a simple instruction, adding the cycle penalties that depend on register values
+// This mirrors CPU::getAddress for the addressing modes simple instructions use
+template <OperandMode mode, bool isWrite, bool shortIndex>
+u32 CachedInterpreter::getAddress (CPU& cpu, u32 operand, u32& cycles) {
+    if constexpr (mode == OperandMode::Direct || mode == OperandMode::Direct_x || mode == OperandMode::Direct_y) {
+        if (cpu.dpOffset & 0xFF) // Add an extra cycle if the low byte of the direct page offset is non-zero
+            cycles++;
+
+        const u16 index = mode == OperandMode::Direct_x ? cpu.x : (mode == OperandMode::Direct_y ? cpu.y : 0);
+        return (u16) (operand + cpu.dpOffset + index);
+    }
+
+    else if constexpr (mode == OperandMode::Absolute)
+        return operand | cpu.dbOffset;
+
+    else if constexpr (mode == OperandMode::Absolute_x || mode == OperandMode::Absolute_y) {
+        const auto base = operand | cpu.dbOffset;
+        const auto address = (base + (mode == OperandMode::Absolute_x ? cpu.x : cpu.y)) & 0xFFFFFF;
+
+        if constexpr (!isWrite && shortIndex) { // Reads take an extra cycle when crossing a page. The other cases are already in the base cycles
+            if ((base & 0xFF00) != (address & 0xFF00))
+                cycles++;
+        }
+
+        return address;
+    }
+
+    else if constexpr (mode == OperandMode::Absolute_long)
+        return operand;
+
+    else // Absolute long, X-indexed
+        return operand + cpu.x;
+}
+
+template <u8 opcode, bool shortAccumulator, bool shortIndex>
+u32 CachedInterpreter::runInstruction (CPU& cpu, const DecodedInstruction& instruction) {
+    constexpr auto operation = simpleInstruction (opcode).operation;
+    constexpr auto mode = simpleInstruction (opcode).mode;
+
+    if constexpr (operation == Operation::None) // No specialized version of this one, so go through the interpreter
+        return CPU::runOpcode <opcode> (cpu);
+
+    else if constexpr (mode == OperandMode::Implied) { // INX, INY, DEX, DEY
+        constexpr bool isX = operation == Operation::INX || operation == Operation::DEX;
+        constexpr bool isIncrement = operation == Operation::INX || operation == Operation::INY;
+        u16& reg = isX ? cpu.x : cpu.y;
+
+        cpu.pc += 1;
+        reg = isIncrement ? reg + 1 : reg - 1;
+        if constexpr (shortIndex) {
+            reg &= 0xFF;
+            cpu.setNZ8 (reg);
+        } else
+            cpu.setNZ16 (reg);
+
+        return instruction.cycles;
+    }
+
+    else {
+        constexpr bool isShort = usesIndexWidth (operation) ? shortIndex : shortAccumulator;
+        u32 cycles = instruction.cycles;
+        cpu.pc += instruction.length;
+
+        u32 address = 0;
+        u16 value = 0;
+        if constexpr (mode == OperandMode::Immediate)
+            value = instruction.operand;
+        else {
+            address = getAddress <mode, isStore (operation), shortIndex> (cpu, instruction.operand, cycles);
+            if constexpr (!isStore (operation))
+                value = isShort ? Memory::read8 (address) : Memory::read16 (address);
+        }
+
+        const auto setNZ = [&] (u16 result) {
+            if constexpr (isShort) cpu.setNZ8 (result);
+            else cpu.setNZ16 (result);
+        };
+
+        const auto store = [&] (u16 reg) {
+            if constexpr (isShort) Memory::write8 (address, reg & 0xFF);
+            else Memory::write16 (address, reg);
+        };
+
+        const auto compare = [&] (u16 reg) {
+            if constexpr (isShort) reg &= 0xFF;
+            setNZ (reg - value);
+            cpu.psw.carry = reg >= value;
+        };
+
+        const auto accumulator = [&] () -> u16 {
+            if constexpr (isShort) return cpu.a.al;
+            else return cpu.a.raw;
+        };
+
+        // Accumulator results only replace the low byte in 8-bit mode
+        const auto setAccumulator = [&] (u16 result) {
+            if constexpr (isShort) cpu.a.al = result;
+            else cpu.a.raw = result;
+            setNZ (result);
+        };
+
+        if constexpr (operation == Operation::LDA) setAccumulator (value);
+        else if constexpr (operation == Operation::ORA) setAccumulator (accumulator() | value);
+        else if constexpr (operation == Operation::AND) setAccumulator (accumulator() & value);
+        else if constexpr (operation == Operation::EOR) setAccumulator (accumulator() ^ value);
+        else if constexpr (operation == Operation::ADC) cpu.adc <!isShort> (value);
+        else if constexpr (operation == Operation::SBC) cpu.sbc <!isShort> (value);
+        else if constexpr (operation == Operation::CMP) compare (cpu.a.raw);
+        else if constexpr (operation == Operation::CPX) compare (cpu.x);
+        else if constexpr (operation == Operation::CPY) compare (cpu.y);
+        else if constexpr (operation == Operation::LDX) { cpu.x = value; setNZ (value); }
+        else if constexpr (operation == Operation::LDY) { cpu.y = value; setNZ (value); }
+        else if constexpr (operation == Operation::STA) store (cpu.a.raw);
+        else if constexpr (operation == Operation::STX) store (cpu.x);
+        else if constexpr (operation == Operation::STY) store (cpu.y);
+        else if constexpr (operation == Operation::STZ) store (0);
+
+        return cycles;
+    }
+}
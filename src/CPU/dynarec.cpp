@@ -0,0 +1,486 @@
+#include <sys/mman.h>
+#include "CPU/cpu.hpp"
+#include "CPU/dynarec.hpp"
+#include "CPU/opcodes.hpp"
+
+// Register allocation for compiled blocks (System V ABI)
+// rbx: Pointer to the CPU object
+// r12d: Cycles taken by the block so far
+// r13: Pointer to the scheduler, so blocks can check whether the next event is due
+// All of them are callee-saved, so they survive the calls to the memory and opcode handlers. eax, ecx, edx, esi and edi are used as scratch registers
+
+namespace {
+    // ALU opcodes in their "op r/m32, r32" form
+    constexpr u8 x86Add = 0x01;
+    constexpr u8 x86Or = 0x09;
+    constexpr u8 x86And = 0x21;
+    constexpr u8 x86Sub = 0x29;
+    constexpr u8 x86Xor = 0x31;
+    constexpr u8 x86Cmp = 0x39;
+    constexpr u8 x86Mov = 0x89;
+
+    // Condition codes for setcc and jcc
+    constexpr u8 conditionAboveOrEqual = 0x3;
+    constexpr u8 conditionZero = 0x4;
+    constexpr u8 conditionNotZero = 0x5;
+
+    void decimalModeALU() {
+        Helpers::panic ("Decimal mode ADC/SBC");
+    }
+}
+
+Dynarec::Dynarec() {
+    void* memory = mmap (nullptr, codeCacheSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        Helpers::panic ("[Dynarec] Failed to allocate executable memory\n");
+
+    codeCache = (u8*) memory;
+    code = codeCache;
+}
+
+Dynarec::~Dynarec() {
+    munmap (codeCache, codeCacheSize);
+}
+
+void Dynarec::flush() {
+    blocks.clear();
+    code = codeCache;
+}
+
+u32 Dynarec::runBlock (CPU& cpu) {
+    const u32 key = ((((u32) cpu.pb << 16) | cpu.pc) << 3) | (cpu.psw.shortAccumulator << 2) | (cpu.psw.shortIndex << 1) | (u32) cpu.emulationMode;
+    const auto iterator = blocks.find (key);
+    const auto block = (iterator != blocks.end()) ? iterator->second : compileBlock (cpu, key);
+
+    const auto cycles = block (&cpu);
+    cpu.blockCycles = 0;
+    return cycles;
+}
+
+Dynarec::Block Dynarec::compileBlock (CPU& cpu, u32 key) {
+    if (code + maxBlockBytes > codeCache + codeCacheSize) // Flush the cache if we're running out of space
+        flush();
+
+    const auto offsetOf = [&cpu] (const auto& member) { return (s32) ((uintptr_t) &member - (uintptr_t) &cpu); };
+    pcOffset = offsetOf (cpu.pc);
+    pswOffset = offsetOf (cpu.psw);
+    aOffset = offsetOf (cpu.a);
+    xOffset = offsetOf (cpu.x);
+    yOffset = offsetOf (cpu.y);
+    directPageOffset = offsetOf (cpu.dpOffset);
+    dataBankOffset = offsetOf (cpu.dbOffset);
+    zeroResultOffset = offsetOf (cpu.zeroResult);
+    signResultOffset = offsetOf (cpu.signResult);
+    blockCyclesOffset = offsetOf (cpu.blockCycles);
+
+    const auto scheduler = Memory::scheduler;
+    timestampOffset = (s32) ((uintptr_t) &scheduler->timestamp - (uintptr_t) scheduler);
+    deadlineOffset = (s32) ((uintptr_t) &scheduler->nextEventTimestamp - (uintptr_t) scheduler);
+
+    const auto block = (Block) code;
+    const bool shortAccumulator = cpu.psw.shortAccumulator;
+    const bool shortIndex = cpu.psw.shortIndex;
+    const u32 bank = (u32) cpu.pb << 16;
+    const auto page = (bank | cpu.pc) >> 11; // Blocks never leave the page they start in, as the next page might not be ROM
+    u16 pc = cpu.pc;
+
+    exitJumps.clear();
+    emitPrologue();
+
+    for (auto i = 0; i < maxBlockSize; i++) {
+        const auto opcode = Memory::read8 (bank | pc);
+        const auto length = instructionLength (opcode, shortAccumulator, shortIndex);
+
+        u32 operand = 0;
+        for (auto byte = 1; byte < length; byte++)
+            operand |= Memory::read8 (bank | (u16) (pc + byte)) << ((byte - 1) * 8);
+
+        // An operand that spills into the next page might not be in ROM, so let the interpreter fetch it when the instruction runs
+        // The PC in the CPU object is kept in sync after every instruction, so the handlers find their operands where they expect
+        const bool operandInPage = ((bank | (u16) (pc + length - 1)) >> 11) == page;
+        if (!operandInPage || !compileNative (opcode, operand, pc, shortAccumulator, shortIndex))
+            emitHandlerCall (opcode);
+
+        pc += length;
+        if (endsBasicBlock (opcode) || ((bank | pc) >> 11) != page || i == maxBlockSize - 1) // Stop at control flow, at the end of the page or if the block is full
+            break;
+
+        // Exit early once the next event is due, so it doesn't fire late. The rest of the block gets compiled as a block of its own
+        emitDeadlineCheck();
+    }
+
+    const auto epilogue = code;
+    emitEpilogue();
+
+    for (auto jump : exitJumps) {
+        const s32 displacement = (s32) (epilogue - (jump + sizeof(u32)));
+        std::memcpy (jump, &displacement, sizeof(s32));
+    }
+
+    blocks[key] = block;
+    return block;
+}
+
+bool Dynarec::compileNative (u8 opcode, u32 operand, u16 pc, bool shortAccumulator, bool shortIndex) {
+    const auto instruction = simpleInstruction (opcode);
+    if (instruction.operation != Operation::None) {
+        compileSimple (instruction, operand, shortAccumulator, shortIndex);
+        emitStorePC (pc + instructionLength (opcode, shortAccumulator, shortIndex));
+        return true;
+    }
+
+    switch (opcode) {
+        case 0x10: case 0x30: case 0x50: case 0x70: case 0x80: case 0x90: case 0xB0: case 0xD0: case 0xF0:
+            return compileBranch (opcode, pc, (s8) operand);
+
+        case 0x4C: // jmp abs
+            emitAddCycles (3);
+            emitStorePC ((u16) operand);
+            return true;
+
+        case 0x18: emitPSWAnd (~0x01); break; // clc
+        case 0x38: emitPSWOr (0x01); break; // sec
+        case 0x58: emitPSWAnd (~0x04); break; // cli
+        case 0x78: emitPSWOr (0x04); break; // sei
+        case 0xB8: emitPSWAnd (~0x40); break; // clv
+        case 0xD8: emitPSWAnd (~0x08); break; // cld
+        case 0xF8: emitPSWOr (0x08); break; // sed
+        case 0xEA: break; // nop
+
+        default: return false;
+    }
+
+    // The flag ops and NOP are all 1 byte long and take 2 cycles
+    emitAddCycles (2);
+    emitStorePC (pc + 1);
+    return true;
+}
+
+// Compile a load, store, ALU op or index increment. This mirrors CachedInterpreter::runInstruction
+void Dynarec::compileSimple (SimpleInstruction instruction, u32 operand, bool shortAccumulator, bool shortIndex) {
+    const auto operation = instruction.operation;
+    const auto mode = instruction.mode;
+    const bool isShort = usesIndexWidth (operation) ? shortIndex : shortAccumulator;
+    emitAddCycles (baseCycles (instruction, shortAccumulator, shortIndex));
+
+    const auto registerOffset = [&] () {
+        switch (operation) {
+            case Operation::LDX: case Operation::STX: case Operation::CPX: case Operation::INX: case Operation::DEX: return xOffset;
+            case Operation::LDY: case Operation::STY: case Operation::CPY: case Operation::INY: case Operation::DEY: return yOffset;
+            default: return aOffset;
+        }
+    }();
+
+    if (mode == OperandMode::Implied) { // INX, INY, DEX, DEY
+        const bool isIncrement = operation == Operation::INX || operation == Operation::INY;
+        emitLoadZeroExtended (EAX, registerOffset, true);
+        emitALUImm (isIncrement ? 0 : 5, EAX, 1); // add/sub eax, 1
+        emitZeroExtend (EAX, !shortIndex);
+        emitStore (EAX, registerOffset, true);
+        emitSetNZ (EAX, !shortIndex);
+        return;
+    }
+
+    // ADC and SBC panic in decimal mode, same as the interpreter. Check before the operand is loaded, as the check clobbers the scratch registers
+    if (operation == Operation::ADC || operation == Operation::SBC) {
+        emit8 (0xF6); emitMemoryOperand (0, pswOffset); emit8 (0x08); // test byte [rbx + psw], 0x08
+        emit8 (0x70 | conditionZero); emit8 (12); // jz over the call
+        emitCall ((const void*) &decimalModeALU);
+    }
+
+    if (mode == OperandMode::Immediate)
+        emitMovImm (EAX, operand);
+    else {
+        emitAddress (mode, operand, isStore (operation), shortIndex); // Address goes in edi, the first argument of the memory handlers
+
+        if (isStore (operation)) {
+            if (operation == Operation::STZ)
+                emitALU (x86Xor, ESI, ESI);
+            else
+                emitLoadZeroExtended (ESI, registerOffset, !isShort);
+
+            emitCall (isShort ? (const void*) &Memory::write8 : (const void*) &Memory::write16);
+            return;
+        }
+
+        emitCall (isShort ? (const void*) &Memory::read8 : (const void*) &Memory::read16);
+        emitZeroExtend (EAX, !isShort);
+    }
+
+    // The operand is now in eax
+    switch (operation) {
+        case Operation::LDA: case Operation::LDX: case Operation::LDY:
+            // Index loads write the whole register, while 8-bit accumulator loads only replace the low byte
+            emitStore (EAX, registerOffset, operation != Operation::LDA || !isShort);
+            emitSetNZ (EAX, !isShort);
+            break;
+
+        case Operation::ORA: case Operation::AND: case Operation::EOR: {
+            const u8 x86Opcode = operation == Operation::ORA ? x86Or : (operation == Operation::AND ? x86And : x86Xor);
+            emitLoadZeroExtended (ECX, aOffset, !isShort);
+            emitALU (x86Opcode, ECX, EAX);
+            emitStore (ECX, aOffset, !isShort);
+            emitSetNZ (ECX, !isShort);
+            break;
+        }
+
+        case Operation::CMP: case Operation::CPX: case Operation::CPY:
+            emitLoadZeroExtended (ECX, registerOffset, !isShort);
+            emitALU (x86Mov, EDX, ECX);
+            emitALU (x86Sub, EDX, EAX);
+            emitZeroExtend (EDX, !isShort);
+            emitPSWAnd (~0x01);
+            emitALU (x86Cmp, ECX, EAX);
+            emitSetCC (conditionAboveOrEqual, ECX); // Carry is set if the register is >= the operand
+            emitPSWOrFrom (ECX);
+            emitSetNZ (EDX, !isShort);
+            break;
+
+        case Operation::ADC: case Operation::SBC: {
+            const u8 signBit = isShort ? 7 : 15;
+            if (operation == Operation::SBC) // Invert the operand and treat the operation as an addition
+                emitALUImm (6, EAX, isShort ? 0xFF : 0xFFFF);
+
+            emitLoadZeroExtended (ECX, aOffset, !isShort);
+            emitLoadZeroExtended (EDX, pswOffset, false);
+            emitALUImm (4, EDX, 1); // Carry in
+            emitALU (x86Add, EDX, ECX);
+            emitALU (x86Add, EDX, EAX); // edx = result
+
+            emitALU (x86Mov, ESI, EDX);
+            emitShift (5, ESI, signBit + 1); // Carry out
+            emitALU (x86Xor, ECX, EDX);
+            emitALU (x86Xor, EAX, EDX);
+            emitALU (x86And, ECX, EAX);
+            emitShift (5, ECX, signBit);
+            emitALUImm (4, ECX, 1);
+            emitShift (4, ECX, 6); // Overflow, moved to bit 6 of the PSW
+            emitALU (x86Or, ECX, ESI);
+
+            emitPSWAnd (~0x41);
+            emitPSWOrFrom (ECX);
+            emitZeroExtend (EDX, !isShort);
+            emitStore (EDX, aOffset, !isShort);
+            emitSetNZ (EDX, !isShort);
+            break;
+        }
+
+        default: Helpers::panic ("[Dynarec] Unhandled simple instruction\n");
+    }
+}
+
+// Conditional branches and BRA. Short backwards branches go through the interpreter, as it checks whether they're idle loops
+bool Dynarec::compileBranch (u8 opcode, u16 pc, s8 displacement) {
+    if (displacement < 0 && displacement >= -CPU::maxIdleLoopSize)
+        return false;
+
+    const u16 nextPC = pc + 2;
+    emitAddCycles (2);
+    emitStorePC (nextPC);
+
+    if (opcode != 0x80) { // Test the flag and skip over the taken path if the branch isn't taken
+        u8 skipCondition;
+        switch (opcode) {
+            case 0x10: case 0x30: // bpl, bmi
+                emit8 (0x66); emit8 (0xF7); emitMemoryOperand (0, signResultOffset); emit16 (0x8000); // test word [rbx + signResult], 0x8000
+                skipCondition = opcode == 0x30 ? conditionZero : conditionNotZero;
+                break;
+
+            case 0xD0: case 0xF0: // bne, beq
+                emit8 (0x66); emit8 (0x83); emitMemoryOperand (7, zeroResultOffset); emit8 (0); // cmp word [rbx + zeroResult], 0
+                skipCondition = opcode == 0xF0 ? conditionNotZero : conditionZero;
+                break;
+
+            default: { // bvc, bvs, bcc, bcs
+                const bool isCarry = opcode == 0x90 || opcode == 0xB0;
+                emit8 (0xF6); emitMemoryOperand (0, pswOffset); emit8 (isCarry ? 0x01 : 0x40); // test byte [rbx + psw], mask
+                skipCondition = (opcode == 0x70 || opcode == 0xB0) ? conditionZero : conditionNotZero;
+                break;
+            }
+        }
+
+        emit8 (0x70 | skipCondition); emit8 (13); // Skip the cycle add (4 bytes) and PC store (9 bytes) below
+    }
+
+    emitAddCycles (1);
+    emitStorePC (nextPC + displacement);
+    return true;
+}
+
+// Compute the effective address of a simple instruction into edi, adding the cycle penalties that depend on register values
+void Dynarec::emitAddress (OperandMode mode, u32 operand, bool isWrite, bool shortIndex) {
+    switch (mode) {
+        case OperandMode::Direct: case OperandMode::Direct_x: case OperandMode::Direct_y:
+            emitLoadZeroExtended (EDI, directPageOffset, true);
+            emitALU (x86Xor, EAX, EAX);
+            emit8 (0xF7); emit8 (0xC7); emit32 (0xFF); // test edi, 0xFF
+            emitSetCC (conditionNotZero, EAX); // Add an extra cycle if the low byte of the direct page offset is non-zero
+            emitAddCyclesFrom (EAX);
+            emitALUImm (0, EDI, operand);
+
+            if (mode != OperandMode::Direct) {
+                emitLoadZeroExtended (EAX, mode == OperandMode::Direct_x ? xOffset : yOffset, true);
+                emitALU (x86Add, EDI, EAX);
+            }
+
+            emit8 (0x0F); emit8 (0xB7); emit8 (0xFF); // movzx edi, di
+            break;
+
+        case OperandMode::Absolute:
+            emitLoad32 (EDI, dataBankOffset);
+            emitALUImm (1, EDI, operand);
+            break;
+
+        case OperandMode::Absolute_x: case OperandMode::Absolute_y:
+            emitLoad32 (EDI, dataBankOffset);
+            emitALUImm (1, EDI, operand);
+            emitALU (x86Mov, ECX, EDI);
+            emitLoadZeroExtended (EAX, mode == OperandMode::Absolute_x ? xOffset : yOffset, true);
+            emitALU (x86Add, EDI, EAX);
+            emitALUImm (4, EDI, 0xFFFFFF);
+
+            if (!isWrite && shortIndex) { // Reads take an extra cycle when crossing a page. The other cases are already in the base cycles
+                emitALU (x86Xor, ECX, EDI);
+                emitALU (x86Xor, EAX, EAX);
+                emit8 (0xF7); emit8 (0xC1); emit32 (0xFF00); // test ecx, 0xFF00
+                emitSetCC (conditionNotZero, EAX);
+                emitAddCyclesFrom (EAX);
+            }
+            break;
+
+        case OperandMode::Absolute_long:
+            emitMovImm (EDI, operand);
+            break;
+
+        case OperandMode::Absolute_long_x:
+            emitLoadZeroExtended (EDI, xOffset, true);
+            emitALUImm (0, EDI, operand);
+            break;
+
+        default: Helpers::panic ("[Dynarec] Unhandled addressing mode\n");
+    }
+}
+
+void Dynarec::emitPrologue() {
+    emit8 (0x53); // push rbx
+    emit8 (0x41); emit8 (0x54); // push r12
+    emit8 (0x41); emit8 (0x55); // push r13 (3 pushes plus the return address keep the stack 16-byte aligned for calls)
+    emit8 (0x48); emit8 (0x89); emit8 (0xFB); // mov rbx, rdi
+    emit8 (0x45); emit8 (0x31); emit8 (0xE4); // xor r12d, r12d
+    emit8 (0x48); emit8 (0xB8); emit64 ((u64) &Memory::scheduler); // mov rax, &Memory::scheduler
+    emit8 (0x4C); emit8 (0x8B); emit8 (0x28); // mov r13, [rax]
+}
+
+void Dynarec::emitEpilogue() {
+    emit8 (0x44); emit8 (0x89); emit8 (0xE0); // mov eax, r12d
+    emit8 (0x41); emit8 (0x5D); // pop r13
+    emit8 (0x41); emit8 (0x5C); // pop r12
+    emit8 (0x5B); // pop rbx
+    emit8 (0xC3); // ret
+}
+
+// Exit the block if timestamp + cycles * 6 has reached the next event. The deadline is re-read every time, as IO writes can schedule earlier events
+void Dynarec::emitDeadlineCheck() {
+    emit8 (0x49); emit8 (0x8B); emit8 (0x85); emit32 (timestampOffset); // mov rax, [r13 + timestamp]
+    emit8 (0x44); emit8 (0x89); emit8 (0xE1); // mov ecx, r12d
+    emit8 (0x48); emit8 (0x8D); emit8 (0x0C); emit8 (0x49); // lea rcx, [rcx + rcx * 2]
+    emit8 (0x48); emit8 (0x8D); emit8 (0x04); emit8 (0x48); // lea rax, [rax + rcx * 2]
+    emit8 (0x49); emit8 (0x3B); emit8 (0x85); emit32 (deadlineOffset); // cmp rax, [r13 + nextEventTimestamp]
+    emit8 (0x0F); emit8 (0x80 | conditionAboveOrEqual); // jae epilogue
+    exitJumps.push_back (code);
+    emit32 (0);
+}
+
+// Handlers see how many cycles the block has taken so far in CPU::blockCycles, so idle loop skips and WAI can land right on the next event
+void Dynarec::emitHandlerCall (u8 opcode) {
+    emit8 (0x44); emit8 (0x89); emitMemoryOperand (4, blockCyclesOffset); // mov dword [rbx + blockCycles], r12d
+    emit8 (0x48); emit8 (0x89); emit8 (0xDF); // mov rdi, rbx
+    emitCall ((const void*) CPU::opcodeHandlers[opcode]);
+    emitAddCyclesFrom (EAX);
+}
+
+void Dynarec::emitCall (const void* function) {
+    emit8 (0x48); emit8 (0xB8); emit64 ((u64) function); // mov rax, function
+    emit8 (0xFF); emit8 (0xD0); // call rax
+}
+
+void Dynarec::emitStorePC (u16 value) {
+    emit8 (0x66); emit8 (0xC7); emitMemoryOperand (0, pcOffset); emit16 (value); // mov word [rbx + pc], value
+}
+
+void Dynarec::emitAddCycles (u8 value) {
+    emit8 (0x41); emit8 (0x83); emit8 (0xC4); emit8 (value); // add r12d, value
+}
+
+void Dynarec::emitAddCyclesFrom (Reg reg) {
+    emit8 (0x41); emit8 (0x01); emit8 (0xC4 | (reg << 3)); // add r12d, reg
+}
+
+void Dynarec::emitPSWAnd (u8 mask) {
+    emit8 (0x80); emitMemoryOperand (4, pswOffset); emit8 (mask); // and byte [rbx + psw], mask
+}
+
+void Dynarec::emitPSWOr (u8 mask) {
+    emit8 (0x80); emitMemoryOperand (1, pswOffset); emit8 (mask); // or byte [rbx + psw], mask
+}
+
+void Dynarec::emitPSWOrFrom (Reg reg) {
+    emit8 (0x08); emitMemoryOperand (reg, pswOffset); // or byte [rbx + psw], reg8
+}
+
+// Update the lazy N and Z flags from a zero-extended result. Clobbers the register
+void Dynarec::emitSetNZ (Reg value, bool is16Bit) {
+    emitStore (value, zeroResultOffset, true);
+    if (!is16Bit) // 8-bit results are stored shifted left by 8 in signResult
+        emitShift (4, value, 8);
+    emitStore (value, signResultOffset, true);
+}
+
+void Dynarec::emitMemoryOperand (u8 reg, s32 offset) {
+    emit8 (0x83 | (reg << 3)); emit32 (offset); // [rbx + disp32]
+}
+
+void Dynarec::emitLoadZeroExtended (Reg dest, s32 offset, bool is16Bit) {
+    emit8 (0x0F); emit8 (is16Bit ? 0xB7 : 0xB6); emitMemoryOperand (dest, offset); // movzx dest, word/byte [rbx + offset]
+}
+
+void Dynarec::emitLoad32 (Reg dest, s32 offset) {
+    emit8 (0x8B); emitMemoryOperand (dest, offset); // mov dest, dword [rbx + offset]
+}
+
+// 8-bit stores only work with al, cl, dl and bl, as the low bytes of the other registers need a REX prefix
+void Dynarec::emitStore (Reg source, s32 offset, bool is16Bit) {
+    if (is16Bit) {
+        emit8 (0x66); emit8 (0x89); // mov word [rbx + offset], source
+    } else
+        emit8 (0x88); // mov byte [rbx + offset], source
+
+    emitMemoryOperand (source, offset);
+}
+
+void Dynarec::emitMovImm (Reg dest, u32 value) {
+    emit8 (0xB8 + dest); emit32 (value); // mov dest, value
+}
+
+void Dynarec::emitALU (u8 opcode, Reg dest, Reg source) {
+    emit8 (opcode); emit8 (0xC0 | (source << 3) | dest); // op dest, source
+}
+
+// extension selects the operation: 0 = add, 1 = or, 4 = and, 5 = sub, 6 = xor
+void Dynarec::emitALUImm (u8 extension, Reg dest, u32 value) {
+    emit8 (0x81); emit8 (0xC0 | (extension << 3) | dest); emit32 (value); // op dest, value
+}
+
+// extension selects the operation: 4 = shl, 5 = shr
+void Dynarec::emitShift (u8 extension, Reg reg, u8 amount) {
+    emit8 (0xC1); emit8 (0xC0 | (extension << 3) | reg); emit8 (amount); // shl/shr reg, amount
+}
+
+// Like 8-bit stores, 8-bit zero extension only works with eax, ecx, edx and ebx
+void Dynarec::emitZeroExtend (Reg reg, bool is16Bit) {
+    emit8 (0x0F); emit8 (is16Bit ? 0xB7 : 0xB6); emit8 (0xC0 | (reg << 3) | reg); // movzx reg, reg16/reg8
+}
+
+void Dynarec::emitSetCC (u8 condition, Reg reg) {
+    emit8 (0x0F); emit8 (0x90 | condition); emit8 (0xC0 | reg); // setcc reg8
+}
@@ -4,7 +4,7 @@
 void irq (u16 vector) {
     push8(pb); // Push PB, PC and flags
     push16(pc);
-    push8(psw.raw);
+    push8(getPSW());
 
     psw.decimal = false; // Turn off decimal mode, disable IRQs, set PB to 0 and the PC to the exception vector
     psw.irqDisable = true;
@@ -28,20 +28,25 @@ void cop() {
     cycles = 8; // 7 in emulation mode, but we don't have that
 }
 
+// STP stops the clock until the system is reset
 void stp() {
-    Helpers::warn ("STP at PC: {:04X}\ns", pc - 1);
-    pc = Memory::cart.resetVector;
-    setPB(0);
+    Helpers::warn ("STP at PC: {:02X}:{:04X}\n", pb, pc - 1);
+    stopped = true;
+    skipToNextEvent (3);
 
-    cycles = 3; // Not accurate, but whatever, nothing uses STP
+    cycles = 3;
 }
 
+// WAI halts the CPU until an interrupt fires. We don't run any instructions until then and just skip to the next event
 void wai() {
-    Helpers::panic ("WAI at {:02X}:{:04X}\n", pb, pc);
+    waitingForInterrupt = true;
+    skipToNextEvent (3);
+
+    cycles = 3;
 }
 
 void rti() {
-    psw.raw = pop8 <false>(); // Pop flags, then pc, then program bank
+    setPSW (pop8 <false>()); // Pop flags, then pc, then program bank
     pc = pop16 <false>();
     setPB(pop8 <false>());
 
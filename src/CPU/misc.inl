@@ -38,7 +38,7 @@ void pushR8 (u8 value) {
     cycles = 3;
 }
 
-void php() { pushR8 (psw.raw); }
+void php() { pushR8 (getPSW()); }
 void phk() { pushR8 (pb); }
 void phb() { pushR8 (db); }
 void phd() {
@@ -156,12 +156,12 @@ void per() {
 }
 
 void rep() {
-    setPSW (psw.raw & ~nextByte());
+    setPSW (getPSW() & ~nextByte());
     cycles = 3;
 }
 
 void sep() {
-    setPSW (psw.raw | nextByte());
+    setPSW (getPSW() | nextByte());
     cycles = 3;
 }
 
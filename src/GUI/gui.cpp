@@ -4,10 +4,17 @@
 #include "snes.hpp"
 #include "utils.hpp"
 
+// Writes from the VRAM editor can happen while the emu thread is running a frame, so hand them over to it instead of touching VRAM ourselves
+static void writeVRAMDebugger (u8*, size_t address, u8 value) {
+    g_snes.queueVRAMEdit (address, value);
+}
+
 GUI::GUI() : window(sf::VideoMode(800, 600), "SFML window") {
     window.setFramerateLimit(60); // cap FPS to 60
     ImGui::SFML::Init(window);    // Init Imgui-SFML
     display.create (256, 224);
+    tileTexture.create (256, 1024); // Enough for all 4096 2bpp tiles, 32 per row
+    tilePixels.resize (256 * 1024);
 
     auto& io = ImGui::GetIO();  // Set some ImGui options
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
@@ -26,12 +33,18 @@ GUI::GUI() : window(sf::VideoMode(800, 600), "SFML window") {
     // Configure memory editor
     memoryEditor.ReadFn = &Memory::read8Debugger;
     memoryEditor.WriteFn = &Memory::write8Debugger;
+    vramEditor.WriteFn = &writeVRAMDebugger;
 
     emuThread = std::thread([&] { g_snes.runAsync(); } ); // Wake up emulator thread
     emuThread.detach();
 }
 
 void GUI::update() {
+    if (!running) // The emu thread applies editor writes before each frame. While paused it's asleep, so apply them here to show them right away
+        g_snes.applyVRAMEdits();
+    if (showTileWindow) // Decode tiles while the emu thread is asleep, as it owns the tile cache
+        updateTileViewer();
+
     // Signal the emu thread to wake up
     if (running)
         pingEmuThread();
@@ -60,6 +73,8 @@ void GUI::update() {
         showDMAInfo();
     if (showPPUWindow)
         showPPURegisters();
+    if (showTileWindow)
+        showTileViewer();
     
     if (showMemoryEditor)
         memoryEditor.DrawWindow ("CPU Memory Editor", nullptr, 0x1000000);
@@ -75,7 +90,10 @@ void GUI::update() {
     if (running) { // Wait for the SNES thread to finish running the frame
         Joypads::update(); // Update pads
         waitEmuThread();
-        g_snes.ppu.bufferIndex ^= 1; // Swap buffers
+        if (g_snes.ppu.frameDrawn) { // Swap buffers, unless the frame was skipped and the PPU didn't draw anything
+            g_snes.ppu.bufferIndex ^= 1;
+            displayDirty |= g_snes.ppu.frameChanged; // If the frame's identical to the last one, the texture's already up to date
+        }
     }
 }
 
@@ -121,6 +139,7 @@ void GUI::showMenuBar() {
             ImGui::MenuItem ("Show DMA info", nullptr, &showDMAWindow);
             ImGui::MenuItem ("Show PPU registers", nullptr, &showPPUWindow);
             ImGui::MenuItem ("Show VRAM editor", nullptr, &showVramEditor);
+            ImGui::MenuItem ("Show tile viewer", nullptr, &showTileWindow);
             ImGui::MenuItem ("Show CPU memory", nullptr, &showMemoryEditor);
             ImGui::MenuItem ("Show SPC memory", nullptr, &showSPCMemory);
             ImGui::EndMenu();
@@ -129,6 +148,22 @@ void GUI::showMenuBar() {
         if (ImGui::BeginMenu("Configuration")) {
             if (ImGui::MenuItem ("Vsync", nullptr, &vsync))
                     window.setFramerateLimit(vsync ? 60 : 0);
+            ImGui::MenuItem ("Cached interpreter", nullptr, &g_snes.cpu.useCachedInterpreter);
+            ImGui::MenuItem ("Skip idle loops", nullptr, &g_snes.cpu.skipIdleLoops);
+
+            if (ImGui::BeginMenu ("Frame skip")) {
+                static const char* frameSkipNames[] = { "Off", "Draw every 2nd frame", "Draw every 3rd frame", "Draw every 4th frame" };
+                auto& ppu = g_snes.ppu;
+
+                for (auto interval = 1; interval <= 4; interval++) {
+                    const bool selected = (interval == 1) ? (ppu.renderPolicy == RenderPolicy::EveryFrame)
+                                                          : (ppu.renderPolicy == RenderPolicy::EveryNthFrame && ppu.frameInterval == interval);
+                    if (ImGui::MenuItem (frameSkipNames[interval - 1], nullptr, selected))
+                        ppu.setRenderPolicy (interval == 1 ? RenderPolicy::EveryFrame : RenderPolicy::EveryNthFrame, interval);
+                }
+
+                ImGui::EndMenu();
+            }
 
             ImGui::End();
         }
@@ -156,17 +191,18 @@ void GUI::showRegisters() {
         ImGui::Text ("Direct Page Offset: %04X", g_snes.cpu.dpOffset);
 
         // Fetch the PSW bits to display (We can't pass ImGui direct pointers, cause we use bitfields :( )
+        const auto psw = g_snes.cpu.getPSW(); // N and Z are evaluated lazily, so they're only correct in here
         bool shortAccumulator = g_snes.cpu.psw.shortAccumulator;
         bool shortIndex = g_snes.cpu.psw.shortIndex;
         bool irqsEnabled = !g_snes.cpu.psw.irqDisable;
         bool decimal = g_snes.cpu.psw.decimal;
-        bool zero = g_snes.cpu.psw.zero;
-        bool sign = g_snes.cpu.psw.sign;
+        bool zero = (psw >> 1) & 1;
+        bool sign = psw >> 7;
         bool carry = g_snes.cpu.psw.carry;
         bool overflow = g_snes.cpu.psw.overflow;
         bool emulationMode = g_snes.cpu.emulationMode;
 
-        ImGui::Text ("PSW: %02X", g_snes.cpu.psw.raw);
+        ImGui::Text ("PSW: %02X", psw);
         ImGui::Checkbox ("8-bit accumulator", &shortAccumulator);
         ImGui::SameLine();
         ImGui::Checkbox ("8-bit indexes    ", &shortIndex);
@@ -280,7 +316,10 @@ void GUI::showPPURegisters() {
         ImGui::Text ("NMITIMEN: %02X", g_snes.ppu.nmitimen);
         ImGui::Text ("H/V IRQ setting: %s", hvConfigs[hvSetting]);
         ImGui::Text ("BG mode: %d", (int) g_snes.ppu.bgmode.mode);
-        ImGui::Text ("TM: %02X", g_snes.ppu.tm);
+        ImGui::Text ("TM: %02X TS: %02X", g_snes.ppu.tm, g_snes.ppu.ts);
+        ImGui::Text ("TMW: %02X TSW: %02X", g_snes.ppu.tmw, g_snes.ppu.tsw);
+        ImGui::Text ("CGWSEL: %02X CGADSUB: %02X", g_snes.ppu.cgwsel.raw, g_snes.ppu.cgadsub.raw);
+        ImGui::Text ("SETINI: %02X Frame: %dx%d", g_snes.ppu.setini.raw, g_snes.ppu.frameWidth, g_snes.ppu.frameHeight);
         
         ImGui::Checkbox ("NMIs enabled", &nmiEnabled);
         ImGui::SameLine();
@@ -289,6 +328,44 @@ void GUI::showPPURegisters() {
     }
 }
 
+// Draw every tile in VRAM in the selected depth and palette, using the PPU's tile cache
+void GUI::updateTileViewer() {
+    auto& ppu = g_snes.ppu;
+    const auto depth = (Depth) tileViewerDepth;
+    const auto tileSize = 8 << tileViewerDepth; // Size of a tile in VRAM words
+    const auto tileCount = 0x8000 / tileSize;
+    const auto palBase = depth == Depth::Bpp8 ? 0 : tileViewerPalette << (tileViewerDepth == 0 ? 2 : 4);
+
+    std::fill (tilePixels.begin(), tilePixels.end(), 0xFF000000);
+    for (auto tile = 0; tile < tileCount; tile++) {
+        const auto rows = ppu.tileCache.getTile (depth, ppu.vram, tile * tileSize);
+        const auto x = (tile & 31) * 8;
+        const auto y = (tile >> 5) * 8;
+
+        for (auto row = 0; row < 8; row++) {
+            for (auto pixel = 0; pixel < 8; pixel++) {
+                const auto palIndex = (rows[row] >> (pixel * 8)) & 0xFF;
+                tilePixels[(y + row) * 256 + x + pixel] = PixelFormats::fromBGR555 <PixelFormat::RGBA8888> (ppu.paletteRAM[(palBase + palIndex) & 0xFF]);
+            }
+        }
+    }
+
+    tileTexture.update ((const sf::Uint8*) tilePixels.data());
+}
+
+void GUI::showTileViewer() {
+    if (ImGui::Begin("Tile viewer")) {
+        static const char* depths[] = { "2bpp", "4bpp", "8bpp" };
+        ImGui::Combo ("Depth", &tileViewerDepth, depths, 3);
+        ImGui::SliderInt ("Palette", &tileViewerPalette, 0, 7);
+
+        sf::Sprite sprite (tileTexture);
+        sprite.setScale (2.f, 2.f);
+        ImGui::Image(sprite);
+        ImGui::End();
+    }
+}
+
 void GUI::showDisplay() {
     if (ImGui::Begin("Display")) {
         const auto size = ImGui::GetContentRegionAvail();
@@ -296,9 +373,22 @@ void GUI::showDisplay() {
         const auto scale_y = size.y / 224.f;
         const auto scale = scale_x < scale_y ? scale_x : scale_y;
 
-        display.update(g_snes.ppu.buffers[g_snes.ppu.bufferIndex ^ 1]); // Present the buffer that's not being currently written to
+        // Present the buffer that's not being currently written to. Hi-res and interlaced frames are bigger, but get shown at the same size
+        const auto index = g_snes.ppu.bufferIndex ^ 1;
+        const auto width = g_snes.ppu.bufferWidth[index];
+        const auto height = g_snes.ppu.bufferHeight[index];
+
+        if (display.getSize() != sf::Vector2u (width, height)) {
+            display.create (width, height);
+            displayDirty = true;
+        }
+
+        if (displayDirty) {
+            display.update(g_snes.ppu.buffers[index]);
+            displayDirty = false;
+        }
         sf::Sprite sprite (display);
-        sprite.setScale (scale, scale);
+        sprite.setScale (scale * 256.f / width, scale * 224.f / height);
         
         ImGui::Image(sprite);
         ImGui::End();
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include "PPU/ppu.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+    constexpr int backdrop = LayerCount; // Bit of the backdrop in CGADSUB, after the real layers
+
+#ifdef __SSE2__
+    __m128i select (__m128i mask, __m128i a, __m128i b) { return _mm_or_si128 (_mm_and_si128 (mask, a), _mm_andnot_si128 (mask, b)); }
+
+    // Add or subtract 8 pairs of BGR555 colours. Each channel is done separately, clamped to [0, 31], and halved in the lanes where half is set
+    template <bool subtract>
+    __m128i blend (__m128i main, __m128i sub, __m128i half) {
+        const auto channelMask = _mm_set1_epi16 (0x1F);
+        auto result = _mm_setzero_si128();
+
+        for (auto shift = 0; shift <= 10; shift += 5) {
+            const auto a = _mm_and_si128 (_mm_srli_epi16 (main, shift), channelMask);
+            const auto b = _mm_and_si128 (_mm_srli_epi16 (sub, shift), channelMask);
+            auto channel = subtract ? _mm_subs_epu16 (a, b) : _mm_add_epi16 (a, b);
+
+            channel = select (half, _mm_srli_epi16 (channel, 1), channel);
+            channel = _mm_min_epi16 (channel, channelMask);
+            result = _mm_or_si128 (result, _mm_slli_epi16 (channel, shift));
+        }
+
+        return result;
+    }
+#else
+    template <bool subtract>
+    u16 blend (u16 main, u16 sub, bool half) {
+        u16 result = 0;
+
+        for (auto shift = 0; shift <= 10; shift += 5) {
+            const int a = (main >> shift) & 0x1F;
+            const int b = (sub >> shift) & 0x1F;
+            int channel = subtract ? std::max (a - b, 0) : (a + b);
+
+            if (half) channel >>= 1;
+            result |= std::min (channel, 0x1F) << shift;
+        }
+
+        return result;
+    }
+#endif
+
+    template <bool subtract>
+    void blendLine (u16* output, const u16* mainColours, const u16* subColours, const u16* enable, const u16* half,
+                    const LineMask& black, const LineMask& prevent) {
+#ifdef __SSE2__
+        for (auto x = 0; x < 256; x += 8) {
+            const auto blackMask = Windows::expand (Windows::getByte (black, x));
+            const auto preventMask = Windows::expand (Windows::getByte (prevent, x));
+
+            // Clip the main screen to black, and skip halving there
+            const auto main = _mm_andnot_si128 (blackMask, _mm_load_si128 ((const __m128i*) &mainColours[x]));
+            const auto sub = _mm_load_si128 ((const __m128i*) &subColours[x]);
+            const auto halfMask = _mm_andnot_si128 (blackMask, _mm_load_si128 ((const __m128i*) &half[x]));
+            const auto enableMask = _mm_andnot_si128 (preventMask, _mm_load_si128 ((const __m128i*) &enable[x]));
+
+            const auto blended = blend <subtract> (main, sub, halfMask);
+            _mm_storeu_si128 ((__m128i*) &output[x], select (enableMask, blended, main));
+        }
+#else
+        for (auto x = 0; x < 256; x++) {
+            const bool clipped = (black[x >> 6] >> (x & 63)) & 1;
+            const bool prevented = (prevent[x >> 6] >> (x & 63)) & 1;
+            const u16 main = clipped ? 0 : mainColours[x];
+
+            output[x] = (enable[x] && !prevented) ? blend <subtract> (main, subColours[x], half[x] && !clipped) : main;
+        }
+#endif
+    }
+}
+
+// Colour math only changes the output if some layer has it enabled, or if the main screen gets clipped to black somewhere
+// Otherwise, the compositor can skip it and read the output straight out of the palette cache
+bool PPU::colourMathActive() const {
+    return (cgadsub.layers != 0 && cgwsel.preventMath != 3) || cgwsel.forceBlack != 0;
+}
+
+// Colour math is done in 2 passes. First we look up the colours of each pixel, and figure out which pixels colour math and halving apply to.
+// Then the actual blending is done on whole BGR555 colours, 8 pixels at a time with SSE2, so no pixel needs to branch on its own
+void PPU::applyColourMath (const std::array <u16, 256>& screen, const std::array <u16, 256>& otherScreen, std::array <u16, 256>& output) {
+    alignas(16) u16 mainColours[256];
+    alignas(16) u16 subColours[256];
+    alignas(16) u16 enable[256]; // All 1s if colour math applies to the pixel
+    alignas(16) u16 half[256]; // All 1s if the result gets halved
+
+    const unsigned mathLayers = cgadsub.layers;
+    const bool useSubscreen = cgwsel.addSubscreen;
+    const bool halve = cgadsub.half;
+
+    for (auto x = 0; x < 256; x++) {
+        const auto mainTag = screen[x];
+        const auto subTag = otherScreen[x];
+        const auto layer = mainTag ? ((mainTag >> 8) & 7) : backdrop;
+        const bool lowOBJPalette = layer == OBJ && (mainTag & 0xFF) < 192; // Sprites using palettes 0-3 never take part in colour math
+
+        // Where the sub screen is transparent, the fixed colour is used instead, and the result is never halved
+        const bool subOpaque = useSubscreen && subTag != 0;
+
+        mainColours[x] = paletteRAM[mainTag & 0xFF];
+        subColours[x] = subOpaque ? paletteRAM[subTag & 0xFF] : fixedColour;
+        enable[x] = (((mathLayers >> layer) & 1) && !lowOBJPalette) ? 0xFFFF : 0;
+        half[x] = (halve && (subOpaque || !useSubscreen)) ? 0xFFFF : 0;
+    }
+
+    const auto black = Windows::region (cgwsel.forceBlack, colourWindow);
+    const auto prevent = Windows::region (cgwsel.preventMath, colourWindow);
+
+    if (cgadsub.subtract)
+        blendLine <true> (output.data(), mainColours, subColours, enable, half, black, prevent);
+    else
+        blendLine <false> (output.data(), mainColours, subColours, enable, half, black, prevent);
+}
@@ -0,0 +1,94 @@
+#include <cstring>
+#include <type_traits>
+#include "PPU/ppu.hpp"
+
+namespace {
+    // Get the raw value of a register, whether it's a plain integer or a bitfield union
+    template <typename T>
+    auto& raw (T& reg) {
+        if constexpr (std::is_arithmetic_v <std::remove_const_t <T>>)
+            return reg;
+        else
+            return reg.raw;
+    }
+
+    // Copy the line registers from a PPU to a snapshot or vice versa. The fields have the same names on both sides
+    template <typename Source, typename Dest>
+    void copyLineState (const Source& from, Dest& to) {
+        to.line = from.line;
+        to.bufferIndex = from.bufferIndex;
+        raw (to.bgmode) = raw (from.bgmode);
+        to.tm = from.tm;
+        to.ts = from.ts;
+        raw (to.setini) = raw (from.setini);
+        to.field = from.field;
+        to.frameWidth = from.frameWidth;
+        to.frameHeight = from.frameHeight;
+
+        for (auto i = 0; i < 4; i++) {
+            raw (to.sc[i]) = raw (from.sc[i]);
+            to.nba[i] = from.nba[i];
+            to.hofs[i] = from.hofs[i];
+            to.vofs[i] = from.vofs[i];
+            to.windowPos[i] = from.windowPos[i];
+        }
+
+        raw (to.m7sel) = raw (from.m7sel);
+        to.m7a = from.m7a;
+        to.m7b = from.m7b;
+        to.m7c = from.m7c;
+        to.m7d = from.m7d;
+        to.m7x = from.m7x;
+        to.m7y = from.m7y;
+        to.m7hofs = from.m7hofs;
+        to.m7vofs = from.m7vofs;
+
+        raw (to.objsel) = raw (from.objsel);
+        raw (to.oamaddr) = raw (from.oamaddr);
+
+        for (auto i = 0; i < 3; i++)
+            to.windowSel[i] = from.windowSel[i];
+        to.windowLogic = from.windowLogic;
+        to.tmw = from.tmw;
+        to.tsw = from.tsw;
+        raw (to.cgwsel) = raw (from.cgwsel);
+        raw (to.cgadsub) = raw (from.cgadsub);
+        to.fixedColour = from.fixedColour;
+    }
+}
+
+PPULineState PPU::saveLineState() const {
+    PPULineState state;
+    std::memset (&state, 0, sizeof (state)); // Zero the padding too, so snapshots can be compared with memcmp
+    copyLineState (*this, state);
+    state.pixelFormat = pixelFormat;
+
+    return state;
+}
+
+void PPU::loadLineState (const PPULineState& state) {
+    // The sprite lists depend on OBJSEL and OAMADDR, so they need to be rebuilt if those changed
+    if (state.objsel != objsel.raw || state.oamaddr != oamaddr.raw)
+        objListsDirty = true;
+
+    if (state.pixelFormat != pixelFormat) // This reconverts the palette cache, so only do it when the format changes
+        setPixelFormat (state.pixelFormat);
+
+    copyLineState (state, *this);
+}
+
+LineSignature PPU::lineSignature() const {
+    LineSignature signature;
+    std::memset (&signature, 0, sizeof (signature));
+
+    const auto state = saveLineState();
+    std::memcpy (&signature.state, &state, sizeof (state));
+    signature.state.bufferIndex = 0; // The same line looks the same in either framebuffer
+    if (frameHeight != maxFrameHeight) // The field toggles every frame, but only matters for interlaced frames
+        signature.state.field = false;
+    signature.vramGeneration = vramGeneration;
+    signature.cgramGeneration = cgramGeneration;
+    signature.oamGeneration = oamGeneration;
+
+    return signature;
+}
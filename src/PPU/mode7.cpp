@@ -0,0 +1,107 @@
+#include "PPU/ppu.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+    // Sign extend a 13-bit mode 7 scroll/centre value
+    int sext13 (s16 value) { return (int) ((u32) value << 19) >> 19; }
+
+    // Clip the difference between the scroll and the centre to 10 bits, the way the PPU does
+    int clip (int value) { return (value & 0x2000) ? (value | ~0x3FF) : (value & 0x3FF); }
+
+#ifndef __SSE2__
+    // Pack the VRAM lookups for a pixel at (x, y) in the 1024x1024 mode 7 plane (16.8 fixed point)
+    // Bits 0-5: Offset of the pixel in its tile, 6-19: Tile map index, 31: Set if the pixel is outside the plane
+    u32 packFetch (s32 x, s32 y) {
+        x >>= 8;
+        y >>= 8;
+        const u32 outside = ((x | y) & ~0x3FF) ? 0x80000000 : 0;
+        x &= 0x3FF;
+        y &= 0x3FF;
+
+        return outside | ((((y >> 3) << 7) | (x >> 3)) << 6) | ((y & 7) << 3) | (x & 7);
+    }
+#endif
+}
+
+// Mode 7 maps every screen pixel to a point in a 1024x1024 plane with an affine transformation
+// The transformation is linear in the screen X coordinate, so instead of doing multiplies per pixel, we compute the plane coordinates
+// of the first pixel and step through the line by adding (A, C) per pixel. With SSE2, we do this for 4 pixels at a time
+// All the matrix and scroll registers are read when the line is drawn, so per-line changes from HDMA are picked up
+void PPU::renderMode7() {
+    if (!((tm | ts) & 1)) return; // Don't render BG1 if it's disabled on both screens
+
+    const int a = m7a, b = m7b, c = m7c, d = m7d;
+    const auto centreX = sext13 (m7x);
+    const auto centreY = sext13 (m7y);
+    const auto hoffset = clip (sext13 (m7hofs) - centreX);
+    const auto voffset = clip (sext13 (m7vofs) - centreY);
+    const int screenY = m7sel.vflip ? (line ^ 0xFF) : line;
+
+    // Plane coordinates of the pixel at screen X = 0. The PPU drops the low 6 bits of each product
+    const s32 originX = ((a * hoffset) & ~63) + ((b * screenY) & ~63) + ((b * voffset) & ~63) + (centreX << 8);
+    const s32 originY = ((c * hoffset) & ~63) + ((d * screenY) & ~63) + ((d * voffset) & ~63) + (centreY << 8);
+
+    // With horizontal flipping, the line starts at X = 255 and walks backwards
+    const s32 stepX = m7sel.hflip ? -a : a;
+    const s32 stepY = m7sel.hflip ? -c : c;
+    const s32 startX = originX + (m7sel.hflip ? a * 255 : 0);
+    const s32 startY = originY + (m7sel.hflip ? c * 255 : 0);
+
+    alignas(16) u32 fetches[256];
+
+#ifdef __SSE2__
+    auto x = _mm_add_epi32 (_mm_set1_epi32 (startX), _mm_setr_epi32 (0, stepX, stepX * 2, stepX * 3));
+    auto y = _mm_add_epi32 (_mm_set1_epi32 (startY), _mm_setr_epi32 (0, stepY, stepY * 2, stepY * 3));
+    const auto stepX4 = _mm_set1_epi32 (stepX * 4);
+    const auto stepY4 = _mm_set1_epi32 (stepY * 4);
+
+    const auto planeMask = _mm_set1_epi32 (0x3FF);
+    const auto fineMask = _mm_set1_epi32 (7);
+    const auto zero = _mm_setzero_si128();
+
+    for (auto i = 0; i < 256; i += 4) {
+        const auto px = _mm_srai_epi32 (x, 8);
+        const auto py = _mm_srai_epi32 (y, 8);
+        const auto outside = _mm_andnot_si128 (_mm_cmpeq_epi32 (_mm_andnot_si128 (planeMask, _mm_or_si128 (px, py)), zero), _mm_set1_epi32 ((int) 0x80000000));
+        const auto wrappedX = _mm_and_si128 (px, planeMask);
+        const auto wrappedY = _mm_and_si128 (py, planeMask);
+
+        const auto mapIndex = _mm_or_si128 (_mm_slli_epi32 (_mm_srli_epi32 (wrappedY, 3), 7), _mm_srli_epi32 (wrappedX, 3));
+        const auto pixelOffset = _mm_or_si128 (_mm_slli_epi32 (_mm_and_si128 (wrappedY, fineMask), 3), _mm_and_si128 (wrappedX, fineMask));
+        const auto fetch = _mm_or_si128 (outside, _mm_or_si128 (_mm_slli_epi32 (mapIndex, 6), pixelOffset));
+
+        _mm_store_si128 ((__m128i*) &fetches[i], fetch);
+        x = _mm_add_epi32 (x, stepX4);
+        y = _mm_add_epi32 (y, stepY4);
+    }
+#else
+    for (s32 i = 0, x = startX, y = startY; i < 256; i++, x += stepX, y += stepY)
+        fetches[i] = packFetch (x, y);
+#endif
+
+    // Now fetch the pixels. The tile map is in the low bytes of the first 16K words of VRAM, and the 8bpp tiles are in the high bytes
+    const auto screenOver = m7sel.screenOver;
+    const u16 tag = (layerRanks().bg[0][0] << 11) | (BG1 << 8);
+    auto& buffer = layerBuffers[BG1];
+
+    for (auto i = 0; i < 256; i++) {
+        const auto fetch = fetches[i];
+        const auto pixelOffset = fetch & 0x3F;
+        unsigned tile;
+
+        if ((fetch & 0x80000000) && screenOver >= 2) {
+            if (screenOver == 2) // Transparent outside the plane
+                continue;
+            tile = 0; // Or filled with tile 0
+        }
+        else
+            tile = vram[(fetch >> 6) & 0x3FFF] & 0xFF;
+
+        const auto colour = vram[(tile << 6) | pixelOffset] >> 8;
+        if (colour)
+            buffer[i] = tag | colour;
+    }
+}
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include "PPU/ppu.hpp"
+
+namespace {
+    // Width and height of small and large sprites, for each OBJSEL size setting
+    constexpr u8 objSizes[8][2][2] = {
+        { { 8, 8 }, { 16, 16 } }, { { 8, 8 }, { 32, 32 } }, { { 8, 8 }, { 64, 64 } }, { { 16, 16 }, { 32, 32 } },
+        { { 16, 16 }, { 64, 64 } }, { { 32, 32 }, { 64, 64 } }, { { 16, 32 }, { 32, 64 } }, { { 16, 32 }, { 32, 32 } }
+    };
+
+    constexpr int maxSpritesPerLine = 32;
+    constexpr int maxTilesPerLine = 34; // Each tile is an 8x1 sliver of a sprite
+
+    // Decoded OAM entry
+    struct Sprite {
+        int x; // Signed, 9-bit
+        u8 y;
+        u16 tile; // Bit 8 selects the second tile table
+        u8 attributes;
+        u8 width, height;
+    };
+
+    Sprite getSprite (const std::array <u8, 544>& oam, OBJSel objsel, int index) {
+        const auto entry = &oam[index * 4];
+        const auto extra = oam[0x200 + (index >> 2)] >> ((index & 3) * 2); // 2 bits per sprite: X bit 8 and size
+        const bool large = extra & 2;
+
+        Sprite sprite;
+        sprite.x = entry[0] | ((extra & 1) << 8);
+        if (sprite.x >= 256) // Sign extend
+            sprite.x -= 512;
+
+        sprite.y = entry[1];
+        sprite.tile = entry[2] | ((entry[3] & 1) << 8);
+        sprite.attributes = entry[3];
+        sprite.width = objSizes[objsel.size][large][0];
+        sprite.height = objSizes[objsel.size][large][1];
+
+        return sprite;
+    }
+
+    // Does any tile of this sliver of a sprite show up on screen?
+    bool tileOnScreen (int x) { return x > -8 && x < 256; }
+}
+
+void PPU::writeOAMDATA (u8 value) {
+    if (oamAddress >= 0x200) // The high table is written a byte at a time. Addresses past the end of OAM mirror it
+        writeOAM (0x200 + (oamAddress & 0x1F), value);
+
+    else if (oamAddress & 1) { // The low table is written a word at a time
+        writeOAM (oamAddress - 1, oamLatch);
+        writeOAM (oamAddress, value);
+    }
+    else
+        oamLatch = value;
+
+    oamAddress = (oamAddress + 1) & 0x3FF;
+}
+
+void PPU::writeOAM (u16 address, u8 value) {
+    if (oam[address] == value) // Games usually reupload all of OAM every frame, even if only a few sprites moved
+        return;
+
+    oam[address] = value;
+    objListsDirty = true;
+    oamGeneration++;
+#ifdef SNES_THREADED_PPU
+    logOAMWrite (address);
+#endif
+}
+
+u8 PPU::readOAMDATA() {
+    const auto value = (oamAddress >= 0x200) ? oam[0x200 + (oamAddress & 0x1F)] : oam[oamAddress];
+    oamAddress = (oamAddress + 1) & 0x3FF;
+
+    return value;
+}
+
+// Find which sprites are on each line. Sprites are evaluated starting from sprite 0, or from the one OAMADDR points to
+// if priority rotation (bit 15) is on, and only the first 32 sprites on a line get displayed
+void PPU::buildOBJLists() {
+    const int firstSprite = (oamaddr.raw & 0x8000) ? ((oamaddr.raw >> 1) & 0x7F) : 0;
+
+    objLineSizes.fill (0);
+    objLineOverflow.fill (false);
+
+    for (auto i = 0; i < 128; i++) {
+        const auto index = (firstSprite + i) & 0x7F;
+        const auto sprite = getSprite (oam, objsel, index);
+        if (sprite.x <= -sprite.width || sprite.x >= 256) // Sprites that are fully off-screen horizontally aren't evaluated
+            continue;
+
+        for (auto row = 0; row < sprite.height; row++) {
+            const auto line = (sprite.y + row) & 0xFF; // Sprites wrap around from the bottom of the screen to the top
+            if (line >= objLineCount)
+                continue;
+
+            if (objLineSizes[line] < maxSpritesPerLine)
+                objLines[line][objLineSizes[line]++] = index;
+            else
+                objLineOverflow[line] = true;
+        }
+    }
+
+    objListsDirty = false;
+}
+
+// The PPU fetches the tiles of the sprites on a line starting from the last one, and stops after 34.
+// So if there's too many, it's the tiles of the first sprites that get dropped
+void PPU::evaluateOBJLine (int* tileBudget) {
+    if (objListsDirty)
+        buildOBJLists();
+
+    const auto count = objLineSizes[line];
+    const auto& sprites = objLines[line];
+    if (objLineOverflow[line])
+        objRangeOver = true;
+
+    int tilesLeft = maxTilesPerLine;
+
+    for (int i = count - 1; i >= 0; i--) {
+        const auto sprite = getSprite (oam, objsel, sprites[i]);
+        int tiles = 0;
+        for (auto x = sprite.x; x < sprite.x + sprite.width; x += 8)
+            tiles += tileOnScreen (x) ? 1 : 0;
+
+        tileBudget[i] = std::min (tiles, tilesLeft);
+        tilesLeft -= tileBudget[i];
+        if (tileBudget[i] < tiles)
+            objTimeOver = true;
+    }
+}
+
+void PPU::updateOBJFlags() {
+    if ((tm | ts) & 0x10) { // Sprites are only evaluated if they're enabled on a screen
+        int tileBudget[maxSpritesPerLine];
+        evaluateOBJLine (tileBudget);
+    }
+}
+
+void PPU::renderOBJLine() {
+    auto& objLine = layerBuffers[OBJ];
+    int tileBudget[maxSpritesPerLine];
+    evaluateOBJLine (tileBudget);
+
+    const auto count = objLineSizes[line];
+    const auto& sprites = objLines[line];
+    const u32 nameBase = objsel.nameBase << 13;
+    const u32 nameGap = (objsel.nameSelect + 1) << 12;
+
+    // Draw the sprites in priority order. Where sprites overlap, the one that comes first wins, regardless of their BG priority
+    for (auto i = 0; i < count; i++) {
+        const auto sprite = getSprite (oam, objsel, sprites[i]);
+        const bool xflip = sprite.attributes & 0x40;
+        const bool yflip = sprite.attributes & 0x80;
+        const u16 colourBase = 128 + ((sprite.attributes >> 1) & 7) * 16; // Sprites use the top half of CGRAM
+        const u16 tag = (layerRanks().obj[(sprite.attributes >> 4) & 3] << 11) | (OBJ << 8);
+
+        auto row = (line - sprite.y) & 0xFF;
+        if (yflip)
+            row = sprite.height - 1 - row;
+
+        const auto tileRow = row >> 3;
+        const auto tilesWide = sprite.width >> 3;
+        auto budget = tileBudget[i];
+
+        for (auto column = 0; column < tilesWide && budget != 0; column++) {
+            const auto screenX = sprite.x + column * 8;
+            if (!tileOnScreen (screenX))
+                continue;
+            budget--;
+
+            // Large sprites are made of multiple tiles, laid out in a 16x16 grid. The row and column wrap around inside the grid
+            const auto tileColumn = xflip ? (tilesWide - 1 - column) : column;
+            const auto tile = (sprite.tile & 0x100) | (((sprite.tile & 0xF0) + (tileRow << 4)) & 0xF0) | ((sprite.tile + tileColumn) & 0x0F);
+            const auto tileAddr = nameBase + ((tile & 0xFF) << 4) + ((tile & 0x100) ? nameGap : 0);
+
+            auto pixels = tileCache.getTile <Depth::Bpp4> (vram, tileAddr)[row & 7];
+            if (pixels == 0)
+                continue;
+            if (xflip)
+                pixels = Tiles::flipRow (pixels);
+
+            const int first = std::max (0, -screenX); // Clip the tile to the screen
+            const int last = std::min (8, 256 - screenX);
+
+            for (auto j = first; j < last; j++) {
+                const auto palIndex = (pixels >> (j * 8)) & 0xFF;
+                const auto x = screenX + j;
+
+                if (!palIndex || objLine[x])
+                    continue;
+                objLine[x] = tag | (colourBase + palIndex);
+            }
+        }
+    }
+}
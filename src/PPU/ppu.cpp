@@ -1,9 +1,113 @@
+#include <algorithm>
+#include <cstring>
 #include "PPU/ppu.hpp"
+#include "memory.hpp"
+#include "mmio.hpp"
+#ifdef SNES_THREADED_PPU
+#include "PPU/render_thread.hpp"
+#endif
 
-template <Depth depth, int number, RenderPriority priority>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+    // Layer priorities for each BG mode, from fullsnes. Modes 2-6 share the same order, though mode 6 only has BG1
+    constexpr LayerRanks mode0Ranks = { { { 8, 11 }, { 7, 10 }, { 2, 5 }, { 1, 4 } }, { 3, 6, 9, 12 } };
+    constexpr LayerRanks mode1Ranks = { { { 6, 9 }, { 5, 8 }, { 1, 3 }, { 0, 0 } }, { 2, 4, 7, 10 } };
+    constexpr LayerRanks mode1BG3PrioRanks = { { { 5, 8 }, { 4, 7 }, { 1, 10 }, { 0, 0 } }, { 2, 3, 6, 9 } }; // BG3 high priority tiles go on top
+    constexpr LayerRanks mode2To6Ranks = { { { 3, 7 }, { 1, 5 }, { 0, 0 }, { 0, 0 } }, { 2, 4, 6, 8 } };
+    constexpr LayerRanks mode7Ranks = { { { 2, 2 }, { 0, 0 }, { 0, 0 }, { 0, 0 } }, { 1, 3, 4, 5 } };
+
+    // Merge a layer into a screen, keeping the front-most pixel of the 2
+    // Tags are below 0x8000, so we can use signed 16-bit maxes, which unlike unsigned ones are available on SSE2
+    void mergeLayer (std::array <u16, 256>& screen, const std::array <u16, 256>& layer) {
+#ifdef __SSE2__
+        for (auto x = 0; x < 256; x += 8) {
+            const auto a = _mm_loadu_si128 ((const __m128i*) &screen[x]);
+            const auto b = _mm_loadu_si128 ((const __m128i*) &layer[x]);
+            _mm_storeu_si128 ((__m128i*) &screen[x], _mm_max_epi16 (a, b));
+        }
+#else
+        for (auto x = 0; x < 256; x++)
+            screen[x] = std::max (screen[x], layer[x]);
+#endif
+    }
+
+    // Same, but pixels inside the window mask are left out
+    void mergeLayer (std::array <u16, 256>& screen, const std::array <u16, 256>& layer, const LineMask& window) {
+        if (Windows::isEmpty (window)) {
+            mergeLayer (screen, layer);
+            return;
+        }
+
+#ifdef __SSE2__
+        for (auto x = 0; x < 256; x += 8) {
+            const auto masked = Windows::expand (Windows::getByte (window, x));
+            const auto a = _mm_loadu_si128 ((const __m128i*) &screen[x]);
+            const auto b = _mm_andnot_si128 (masked, _mm_loadu_si128 ((const __m128i*) &layer[x]));
+            _mm_storeu_si128 ((__m128i*) &screen[x], _mm_max_epi16 (a, b));
+        }
+#else
+        for (auto x = 0; x < 256; x++) {
+            if (!((window[x >> 6] >> (x & 63)) & 1))
+                screen[x] = std::max (screen[x], layer[x]);
+        }
+#endif
+    }
+
+    // Write a line of palette indices to the framebuffer, looking up their colours in the palette cache
+    template <typename Pixel>
+    void writePalettedLine (u8* output, const std::array <u16, 256>& screen, const std::array <u32, 256>& palette) {
+        const auto pixels = (Pixel*) output;
+        for (auto x = 0; x < 256; x++)
+            pixels[x] = (Pixel) palette[screen[x] & 0xFF];
+    }
+
+    template <PixelFormat format, typename Pixel>
+    void writeBlendedLine (u8* output, const std::array <u16, 256>& colours) {
+        const auto pixels = (Pixel*) output;
+        for (auto x = 0; x < 256; x++)
+            pixels[x] = (Pixel) PixelFormats::fromBGR555 <format> (colours[x]);
+    }
+
+    // Interleave 2 lines of 256 pixels into a 512 pixel line. Passing the same line twice doubles every pixel of it
+    template <typename Pixel>
+    void interleaveLine (u8* output, const u8* even, const u8* odd) {
+        const auto pixels = (Pixel*) output;
+        for (auto x = 0; x < 256; x++) {
+            pixels[x * 2] = ((const Pixel*) even)[x];
+            pixels[x * 2 + 1] = ((const Pixel*) odd)[x];
+        }
+    }
+
+    void interleaveLine (u8* output, const u8* even, const u8* odd, int pixelSize) {
+        switch (pixelSize) {
+            case 4: interleaveLine <u32> (output, even, odd); break;
+            case 2: interleaveLine <u16> (output, even, odd); break;
+            default: interleaveLine <u8> (output, even, odd); break;
+        }
+    }
+}
+
+const LayerRanks& PPU::layerRanks() const {
+    switch (bgmode.mode) {
+        case 0: return mode0Ranks;
+        case 1: return bgmode.bg3prio ? mode1BG3PrioRanks : mode1Ranks;
+        case 7: return mode7Ranks;
+        default: return mode2To6Ranks;
+    }
+}
+
+template <Depth depth, int number>
 void PPU::renderBG() {
     constexpr int index = number - 1; // BGs are numbered 1-4 but array indices start at 0
-    if (!(tm & (1 << index))) return; // Don't render BG if it's disabled in TM
+    if (!((tm | ts) & (1 << index))) return; // Don't render BG if it's disabled on both screens
+
+    const auto& ranks = layerRanks().bg[index];
+    const u16 lowTag = (ranks[0] << 11) | (index << 8); // Tags for low and high priority tiles
+    const u16 highTag = (ranks[1] << 11) | (index << 8);
+    auto& buffer = layerBuffers[index];
 
     const auto bgSize = sc[index].size;
     unsigned ypos = line + vofs[index];
@@ -24,154 +128,677 @@ void PPU::renderBG() {
     }
 
     const auto tileY = ypos & 7; // Which line of the tile are we in?
+    const auto fineX = xpos & 7; // How many pixels of the first tile are scrolled off the left edge
 
-    // The tile info
-    unsigned palNum;
-    unsigned line1_low, line1_high, line2_low, line2_high, line3_low, line3_high, line4_low, line4_high;
-    unsigned tileYFlipped; // This contains (ypos & 7) if the tile is flipped, or ((ypos & 7) ^ 7) if it is
-    unsigned tileXFlip;
-    bool firstTile = true; // Is this the first tile we're actually rendering
+    // Render a tile at a time. The first and last tile can be partially off-screen, depending on the fine X scroll
+    for (int screenX = -(int) fineX; screenX < 256; screenX += 8) {
+        const unsigned tileXpos = xpos + screenX; // The X coordinate of the tile's leftmost pixel in the BG
+        auto tileMapAddr = (((ypos >> 3) & 31) << 5) + ((u8) tileXpos >> 3) + bgMapStart; // >> 3: Divide ypos by 8 to see which row on the tilemap we're at
+                                                                                          // & 31: Mask the row number by 31 - After all, the tile map is simply 1 or more 32x32 maps, depending on BGSIZE
+                                                                                          // << 5: Multiply by 32 to get the address of the tilemap row
+                                                                                          // + ((u8) tileXpos >> 3): Index into the tile row to get the tilemap entry address, masking xpos like we mask ypos
+        if ((tileXpos & 0x1FF) > 255) { // Handle 64-wide BGs
+            if (bgSize == 1 || bgSize == 3)
+                tileMapAddr += 0x400;
+        }
+
+        const auto mapEntry = vram[tileMapAddr & 0x7FFF]; // Fetch the tile map entry
+        // Fetch tile attributes
+
+        const auto tag = (mapEntry & (1 << 13)) ? highTag : lowTag;
+        const auto tileNum = mapEntry & 0x3FF;
+        const bool xflip = mapEntry & (1 << 14);
+        const bool yflip = mapEntry & (1 << 15);
+        const auto palNum = (mapEntry >> 10) & 7;
+        const auto tileYFlipped = (yflip) ? tileY ^ 7 : tileY; // Handle y-flipping
+
+        // Fetch the decoded row of the tile. Each byte of it is the palette index of a pixel, from left to right
+        u64 pixels;
+        unsigned palBase;
+
+        if constexpr (depth == Depth::Bpp2) {
+            pixels = tileCache.getTile <depth> (vram, tileDataStart + tileNum * 8)[tileYFlipped];
+            palBase = 4 * palNum;
+            if (bgmode.mode == 0) // In mode 0, each BG gets its own 32 colours
+                palBase += index * 32;
+        }
+
+        else if constexpr (depth == Depth::Bpp4) {
+            pixels = tileCache.getTile <depth> (vram, tileDataStart + tileNum * 16)[tileYFlipped];
+            palBase = 16 * palNum;
+        }
+
+        else {
+            pixels = tileCache.getTile <depth> (vram, tileDataStart + tileNum * 32)[tileYFlipped];
+            palBase = 0; // 8bpp tiles can use all 256 colours, so they ignore the palette number
+        }
 
-    for (auto x = 0; x < 256; x++, xpos++) {
-        if (scanlineBuffer[x]) // Don't render pixel if it's already been drawn over
+        if (pixels == 0) // The row is fully transparent
             continue;
 
-        auto tileX = xpos & 7; // Which column of the tile are we in?
-        
-        if (firstTile || tileX == 0) { // Fetch the information for a new tile if we need to (IE if we got to the end of a tile, or if we just started rendering)
-            firstTile = false;
-            auto tileMapAddr = (((ypos >> 3) & 31) << 5) + ((u8) xpos >> 3) + bgMapStart; // >> 3: Divide ypos by 8 to see which row on the tilemap we're at
-                                                                                           // & 31: Mask the row number by 31 - After all, the tile map is simply 1 or more 32x32 maps, depending on BGSIZE
-                                                                                           // << 5: Multiply by 32 to get the address of the tilemap row
-                                                                                           // + ((u8) xpos >> 3): Index into the tile row to get the tilemap entry address, masking xpos like we mask ypos
-            if ((xpos & 0x1FF) > 255) { // Handle 64-wide BGs
-                if (bgSize == 1 || bgSize == 3)
-                    tileMapAddr += 0x400;
-            }
+        if (xflip)
+            pixels = Tiles::flipRow (pixels);
 
-            const auto mapEntry = vram[tileMapAddr]; // Fetch the tile map entry
-            // Fetch tile attributes
-            
-            if constexpr (priority != RenderPriority::Both) { // skip to next tile if the tile's priority is not right
-                const bool tilePriority = mapEntry & (1 << 13);
-                if ((priority == RenderPriority::High && !tilePriority) || (priority == RenderPriority::Low && tilePriority)) { // Check if we need to skip the tile
-                    firstTile = true;
-                    continue;
-                }
-            }
+        const int first = std::max (0, -screenX); // Clip the tile to the screen
+        const int last = std::min (8, 256 - screenX);
 
-            const auto tileNum = mapEntry & 0x3FF;
-            const bool xflip = mapEntry & (1 << 14);
-            const bool yflip = mapEntry & (1 << 15);
-            
-            palNum = (mapEntry >> 10) & 7;
-            tileYFlipped = (yflip) ? tileY ^ 7 : tileY; // Handle y-flipping
-            tileXFlip = (xflip) ? 7 : 0; // Handle x flipping
-
-            if constexpr (depth == Depth::Bpp2) {
-                const u32 tileAddr = tileDataStart + tileNum * 8;
-                const auto lineAddr = tileAddr + tileYFlipped; // Address of the line of the tile to render
-
-                const auto line = vram[lineAddr];
-                line1_low = line & 0xFF;
-                line1_high = line >> 8;
-            }
+        for (auto i = first; i < last; i++) {
+            const auto palIndex = (pixels >> (i * 8)) & 0xFF;
+            const auto x = screenX + i;
+
+            if (palIndex) // Skip transparent pixels
+                buffer[x] = tag | (palIndex + palBase);
+        }
+    }
+}
 
-            else if constexpr (depth == Depth::Bpp4) {
-                const u32 tileAddr = tileDataStart + tileNum * 16;
-                const auto lineAddr = tileAddr + tileYFlipped; // Address of the line of the tile to render
+// BGs in modes 5 and 6 are drawn at 512 pixels per line, with 16 pixel wide tiles made of 2 consecutive 8x8 tiles. The horizontal scroll is still
+// in 256 pixel units. In interlaced frames they also get twice the vertical resolution, with each field drawing every other line of the BG
+// The even columns go to the sub screen and the odd ones to the main screen, so they're written to hiresBuffers and layerBuffers respectively
+template <Depth depth, int number>
+void PPU::renderHiresBG() {
+    constexpr int index = number - 1;
+    if (!((tm | ts) & (1 << index))) return;
 
-                const auto line1 = vram[lineAddr];
-                const auto line2 = vram[lineAddr + 8];
+    const auto& ranks = layerRanks().bg[index];
+    const u16 lowTag = (ranks[0] << 11) | (index << 8);
+    const u16 highTag = (ranks[1] << 11) | (index << 8);
+    constexpr u32 tileSize = depth == Depth::Bpp2 ? 8 : depth == Depth::Bpp4 ? 16 : 32; // In words
 
-                line1_low = line1 & 0xFF;
-                line1_high = line1 >> 8;
-                line2_low = line2 & 0xFF;
-                line2_high = line2 >> 8;
-            }
+    const auto bgSize = sc[index].size;
+    unsigned ypos = outputRow() + vofs[index];
+    unsigned xpos = hofs[index] * 2;
+
+    const auto tileDataStart = nba[index] << 12;
+    auto bgMapStart = ((u32) sc[index].base & 0x1F) << 10;
+    if ((ypos & 0x1FF) > 255) { // Same as renderBG
+        if (bgSize == 2) bgMapStart += 0x400;
+        else if (bgSize == 3) bgMapStart += 0x800;
+    }
+
+    const auto tileY = ypos & 7;
+    const auto fineX = xpos & 7;
 
-            else {
-                const u32 tileAddr = tileDataStart + tileNum * 32;
-                const auto lineAddr = tileAddr + tileYFlipped; // Address of the line of the tile to render
-
-                const auto line1 = vram[lineAddr];
-                const auto line2 = vram[lineAddr + 8];
-                const auto line3 = vram[lineAddr + 16];
-                const auto line4 = vram[lineAddr + 24];
-
-                line1_low = line1 & 0xFF;
-                line1_high = line1 >> 8;
-                line2_low = line2 & 0xFF;
-                line2_high = line2 >> 8;
-                line3_low = line3 & 0xFF;
-                line3_high = line3 >> 8;
-                line4_low = line4 & 0xFF;
-                line4_high = line4 >> 8;
+    // Render half a tile at a time
+    for (int screenX = -(int) fineX; screenX < 512; screenX += 8) {
+        const unsigned tileXpos = xpos + screenX;
+        auto tileMapAddr = (((ypos >> 3) & 31) << 5) + ((tileXpos >> 4) & 31) + bgMapStart;
+        if ((tileXpos & 0x3FF) > 511 && (bgSize == 1 || bgSize == 3)) // 64 tile wide BGs are 1024 pixels wide in hi-res
+            tileMapAddr += 0x400;
+
+        const auto mapEntry = vram[tileMapAddr & 0x7FFF];
+        const auto tag = (mapEntry & (1 << 13)) ? highTag : lowTag;
+        const bool xflip = mapEntry & (1 << 14);
+        const bool yflip = mapEntry & (1 << 15);
+        const auto palBase = depth == Depth::Bpp8 ? 0 : ((mapEntry >> 10) & 7) * (depth == Depth::Bpp2 ? 4 : 16);
+        const auto half = ((tileXpos >> 3) & 1) ^ xflip; // Which of the 2 tiles this half of the tile comes from
+        const auto tileNum = ((mapEntry & 0x3FF) + half) & 0x3FF;
+
+        auto pixels = tileCache.getTile <depth> (vram, tileDataStart + tileNum * tileSize)[yflip ? (tileY ^ 7) : tileY];
+        if (pixels == 0)
+            continue;
+        if (xflip)
+            pixels = Tiles::flipRow (pixels);
+
+        const int first = std::max (0, -screenX);
+        const int last = std::min (8, 512 - screenX);
+
+        for (auto i = first; i < last; i++) {
+            const auto palIndex = (pixels >> (i * 8)) & 0xFF;
+            const auto x = screenX + i;
+
+            if (palIndex) {
+                auto& buffer = (x & 1) ? layerBuffers[index] : hiresBuffers[index];
+                buffer[x >> 1] = tag | (palIndex + palBase);
             }
         }
+    }
+}
 
-        tileX ^= tileXFlip; // If xflip is on, this will xor tileX with 7, otherwise 0
-        
-        // Use the low and high bytes to get the palette index from the bit-plane
-        // The "x ^ 7" is just a faster way of doing "7-x" provided x is in range [0, 7]
-        if constexpr (depth == Depth::Bpp2) {
-            const auto palIndex = ((line1_low >> (tileX ^ 7) & 1)) | ((line1_high >> (tileX ^ 7) & 1) << 1);
-            if (!palIndex) continue;
-            scanlineBuffer[x] = palIndex + 4 * palNum;
+void PPU::renderScanline() {
+    const bool hiresBGs = bgmode.mode == 5 || bgmode.mode == 6;
+    for (auto& buffer : layerBuffers)
+        buffer.fill (0);
+    if (hiresBGs)
+        for (auto& buffer : hiresBuffers)
+            buffer.fill (0);
+
+    // Render every enabled layer once, in the depth the BG mode uses for it
+    switch (bgmode.mode) {
+        case 0:
+            renderBG <Depth::Bpp2, 1>();
+            renderBG <Depth::Bpp2, 2>();
+            renderBG <Depth::Bpp2, 3>();
+            renderBG <Depth::Bpp2, 4>();
+            break;
+
+        case 1:
+            renderBG <Depth::Bpp4, 1>();
+            renderBG <Depth::Bpp4, 2>();
+            renderBG <Depth::Bpp2, 3>();
+            break;
+
+        case 2: // TODO: Offset-per-tile
+            renderBG <Depth::Bpp4, 1>();
+            renderBG <Depth::Bpp4, 2>();
+            break;
+
+        case 3:
+            renderBG <Depth::Bpp8, 1>();
+            renderBG <Depth::Bpp4, 2>();
+            break;
+
+        case 4: // TODO: Offset-per-tile
+            renderBG <Depth::Bpp8, 1>();
+            renderBG <Depth::Bpp2, 2>();
+            break;
+
+        case 5:
+            renderHiresBG <Depth::Bpp4, 1>();
+            renderHiresBG <Depth::Bpp2, 2>();
+            break;
+
+        case 6: // TODO: Offset-per-tile
+            renderHiresBG <Depth::Bpp4, 1>();
+            break;
+
+        case 7: renderMode7(); break; // TODO: EXTBG
+    }
+
+    if ((tm | ts) & 0x10)
+        renderOBJLine();
+
+    updateWindows();
+    const bool hires = hiresLine();
+    const bool colourMath = pixelFormat != PixelFormat::Indexed8 && colourMathActive(); // Blended colours have no CGRAM index
+    const bool needSubscreen = hires || (colourMath && cgwsel.addSubscreen); // Outside of hi-res, the sub screen is only ever seen through colour math
+
+    // Resolve the main and sub screens. Each pixel ends up with the front-most layer, or 0 (the backdrop) if they're all transparent
+    // Layers enabled in TMW/TSW are hidden inside their window on that screen
+    mainScreen.fill (0);
+    subScreen.fill (0);
+    for (auto layer = 0; layer < LayerCount; layer++) {
+        const auto bit = 1 << layer;
+        if (tm & bit) {
+            if (tmw & bit) mergeLayer (mainScreen, layerBuffers[layer], layerWindows[layer]);
+            else mergeLayer (mainScreen, layerBuffers[layer]);
         }
 
-        // Same here, except with 4 bits per pixel instead
-        else if constexpr (depth == Depth::Bpp4) {
-            const auto palIndex = ((line1_low >> (tileX ^ 7) & 1)) | ((line1_high >> (tileX ^ 7) & 1) << 1) | ((line2_low >> (tileX ^ 7) & 1) << 2) | ((line2_high >> (tileX ^ 7) & 1) << 3);
-            if (!palIndex) continue;
-            scanlineBuffer[x] = palIndex + 16 * palNum;
+        if (needSubscreen && (ts & bit)) {
+            const auto& source = (hiresBGs && layer != OBJ) ? hiresBuffers[layer] : layerBuffers[layer];
+            if (tsw & bit) mergeLayer (subScreen, source, layerWindows[layer]);
+            else mergeLayer (subScreen, source);
         }
+    }
 
-        else {
-            const auto palIndex = ((line1_low >> (tileX ^ 7) & 1)) | ((line1_high >> (tileX ^ 7) & 1) << 1) | ((line2_low >> (tileX ^ 7) & 1) << 2) | ((line2_high >> (tileX ^ 7) & 1) << 3) |
-                                  ((line3_low >> (tileX ^ 7) & 1) << 4) | ((line3_high >> (tileX ^ 7) & 1) << 5) | ((line4_low >> (tileX ^ 7) & 1) << 6) | ((line4_high >> (tileX ^ 7) & 1) << 7);
-            scanlineBuffer[x] = palIndex; // We don't need to check if palIndex == 0 here, because if it is it'll just write 0 anyways
+    if (colourMath)
+        applyColourMath (mainScreen, subScreen, lineColours);
+    writeLine (colourMath, hires);
+}
+
+// Lines are 256 pixels wide, unless the frame has hi-res lines in it. Then every line is 512 pixels wide, and the pixels of lo-res lines are doubled
+// Hi-res lines show the sub screen in the even columns. Colour math applies to those too, with the roles of the 2 screens swapped
+void PPU::writeLine (bool colourMath, bool hires) {
+    const auto pixelSize = bytesPerPixel();
+    const auto output = buffers[bufferIndex] + outputRow() * frameWidth * pixelSize;
+
+    if (frameWidth == 256) {
+        writeScreen (output, mainScreen, lineColours, colourMath);
+        return;
+    }
+
+    alignas(16) u8 mainPixels[256 * 4];
+    writeScreen (mainPixels, mainScreen, lineColours, colourMath);
+
+    if (hires) {
+        alignas(16) std::array <u16, 256> subColours;
+        alignas(16) u8 subPixels[256 * 4];
+        if (colourMath)
+            applyColourMath (subScreen, mainScreen, subColours);
+
+        writeScreen (subPixels, subScreen, subColours, colourMath);
+        interleaveLine (output, subPixels, mainPixels, pixelSize);
+    }
+
+    else
+        interleaveLine (output, mainPixels, mainPixels, pixelSize);
+}
+
+void PPU::writeScreen (u8* output, const std::array <u16, 256>& screen, const std::array <u16, 256>& colours, bool colourMath) {
+    if (!colourMath) { // Translate the palettes in the scanline buffer to the output format
+        switch (bytesPerPixel()) {
+            case 4: writePalettedLine <u32> (output, screen, paletteCache); break;
+            case 2: writePalettedLine <u16> (output, screen, paletteCache); break;
+            default: writePalettedLine <u8> (output, screen, paletteCache); break;
         }
+
+        return;
+    }
+
+    // Convert the blended BGR555 colours
+    switch (pixelFormat) {
+        case PixelFormat::RGBA8888: writeBlendedLine <PixelFormat::RGBA8888, u32> (output, colours); break;
+        case PixelFormat::XRGB8888: writeBlendedLine <PixelFormat::XRGB8888, u32> (output, colours); break;
+        case PixelFormat::RGB565: writeBlendedLine <PixelFormat::RGB565, u16> (output, colours); break;
+        case PixelFormat::BGR555: std::memcpy (output, colours.data(), 256 * sizeof (u16)); break;
+        default: Helpers::panic ("Colour math with indexed output\n");
     }
 }
 
-void PPU::renderScanline() {
-    scanlineBuffer.fill (0);
-
-    switch (bgmode.mode) { // TODO: Implement all BG modes properly
-        case 0: renderBG <Depth::Bpp2, 1, RenderPriority::Both>(); break;
-        case 1: 
-            if (bgmode.bg3prio) {
-                renderBG <Depth::Bpp2, 3, RenderPriority::High>();
-                renderBG <Depth::Bpp4, 1, RenderPriority::High>();
-                renderBG <Depth::Bpp4, 2, RenderPriority::High>();
-                renderBG <Depth::Bpp4, 1, RenderPriority::Low>();
-                renderBG <Depth::Bpp4, 2, RenderPriority::Low>();
-                renderBG <Depth::Bpp2, 3, RenderPriority::Low>();
-            }
+// Calculate the window masks of every layer and the colour window for this line
+void PPU::updateWindows() {
+    const auto window1 = Windows::span (windowPos[0], windowPos[1]);
+    const auto window2 = Windows::span (windowPos[2], windowPos[3]);
 
-            else {
-                renderBG <Depth::Bpp4, 1, RenderPriority::High>();
-                renderBG <Depth::Bpp4, 2, RenderPriority::High>();
-                renderBG <Depth::Bpp4, 1, RenderPriority::Low>();
-                renderBG <Depth::Bpp4, 2, RenderPriority::Low>();
-                renderBG <Depth::Bpp2, 3, RenderPriority::High>();
-                renderBG <Depth::Bpp2, 3, RenderPriority::Low>();
-            }
+    for (auto i = 0; i <= LayerCount; i++) { // The colour window comes after the layers in every window register
+        const auto select = (windowSel[i >> 1] >> ((i & 1) * 4)) & 0xF;
+        const auto logic = (windowLogic >> (i * 2)) & 3;
+        auto& mask = (i == LayerCount) ? colourWindow : layerWindows[i];
+
+        mask = Windows::combine (window1, window2, select, logic);
+    }
+}
+
+void PPU::writeCGDATA (u8 value) {
+    if (paletteLatch) {
+        const auto palette = ((value & 0x7F) << 8) | latchedPalette; // MSB of palette is ignored
+        if (paletteRAM[paletteAddr] != palette) { // Rewriting the same colour doesn't make any lines dirty
+            setPalette (paletteAddr, palette);
+            cgramGeneration++;
+#ifdef SNES_THREADED_PPU
+            logCGRAMWrite (paletteAddr);
+#endif
+        }
+
+        paletteAddr++; // Increment palette address
+    }
+
+    else
+        latchedPalette = value;
+
+    paletteLatch = !paletteLatch;
+}
+
+void PPU::setPalette (u8 index, u16 value) {
+    paletteRAM[index] = value;
+
+    switch (pixelFormat) { // Convert palette to the output format and cache it for later to be used by the PPU
+        case PixelFormat::RGBA8888: paletteCache[index] = PixelFormats::fromBGR555 <PixelFormat::RGBA8888> (value); break;
+        case PixelFormat::XRGB8888: paletteCache[index] = PixelFormats::fromBGR555 <PixelFormat::XRGB8888> (value); break;
+        case PixelFormat::RGB565: paletteCache[index] = PixelFormats::fromBGR555 <PixelFormat::RGB565> (value); break;
+        case PixelFormat::BGR555: paletteCache[index] = PixelFormats::fromBGR555 <PixelFormat::BGR555> (value); break;
+        case PixelFormat::Indexed8: paletteCache[index] = index; break;
+    }
+}
+
+void PPU::setPixelFormat (PixelFormat format) {
+    pixelFormat = format;
+    for (auto i = 0; i < 256; i++) // Convert the palette cache to the new format
+        setPalette (i, paletteRAM[i]);
+}
+
+void PPU::startFrame() {
+    switch (renderPolicy) {
+        case RenderPolicy::EveryFrame: drawingFrame = true; break;
+        case RenderPolicy::Never: drawingFrame = false; break;
+
+        case RenderPolicy::EveryNthFrame:
+            drawingFrame = framesUntilDraw == 0;
+            framesUntilDraw = drawingFrame ? (frameInterval - 1) : (framesUntilDraw - 1);
             break;
 
-        case 3: renderBG <Depth::Bpp8, 1, RenderPriority::Both>(); break;
-        default: Helpers::panic ("Unimplemented BG mode {}\n", bgmode.mode);
+        case RenderPolicy::OnRequest:
+            drawingFrame = frameRequested;
+            frameRequested = false;
+            break;
     }
 
-    auto framebuffer = buffers[bufferIndex];
-    auto index = line * 256 * 4; // The screen is 256 pixels wide, each pixel being 4 bytes
-    
-    for (auto x = 0; x < 256; x++) { // Translate the palettes in the scanline buffer to RGBA8888 colors
-        const auto palette = scanlineBuffer[x];
-        const auto color = paletteCache[palette];
+    frameChanged = false;
+    field = !field;
+    // Frames get widened when a hi-res line shows up. If the last frame had any, this one most likely will too, so it starts out wide
+    if (drawingFrame) {
+        resizeBuffer (hiresFrame ? 512 : 256, setini.interlace ? maxFrameHeight : 224);
+        hiresFrame = false;
+    }
+}
 
-        *(u32*) &framebuffer[index] = color;
-        index += 4;
+void PPU::resizeBuffer (int width, int height) {
+    frameWidth = width;
+    frameHeight = height;
+    auto& oldWidth = bufferWidth[bufferIndex];
+    auto& oldHeight = bufferHeight[bufferIndex];
+    if (oldWidth == width && oldHeight == height)
+        return;
+
+#ifdef SNES_THREADED_PPU
+    if (renderThread != nullptr) // The render thread might still be drawing into the old buffer
+        renderThread->waitIdle();
+#endif
+
+    const auto oldBuffer = buffers[bufferIndex];
+    const auto newBuffer = new u8[width * height * 4]();
+    const auto pixelSize = bytesPerPixel();
+
+    if (oldWidth == 256 && width == 512 && oldHeight == height) { // Widening a frame that's being drawn. The lines drawn so far get their pixels doubled
+        for (auto row = 0; row < height; row++)
+            interleaveLine (&newBuffer[row * 512 * pixelSize], &oldBuffer[row * 256 * pixelSize], &oldBuffer[row * 256 * pixelSize], pixelSize);
     }
-}
\ No newline at end of file
+
+    delete[] oldBuffer;
+    buffers[bufferIndex] = newBuffer;
+    oldWidth = width;
+    oldHeight = height;
+    bufferLines[bufferIndex].fill (LineSignature::none());
+
+#ifdef SNES_THREADED_PPU
+    if (renderThread != nullptr)
+        renderThread->setBuffers (*this);
+#endif
+}
+
+// Interlaced frames only draw every other row. The rows of the other field are taken from the last frame, which was the other field
+void PPU::weaveLine() {
+    const auto front = bufferIndex ^ 1;
+    if (bufferWidth[front] != frameWidth || bufferHeight[front] != frameHeight)
+        return;
+
+    const auto row = line * 2 + !field;
+    const auto& signature = bufferLines[front][row];
+    if (signature.state.pixelFormat != pixelFormat || signature.state.line == -1 || bufferLines[bufferIndex][row] == signature)
+        return;
+
+    const auto rowSize = frameWidth * bytesPerPixel();
+    std::memcpy (&buffers[bufferIndex][row * rowSize], &buffers[front][row * rowSize], rowSize);
+    bufferLines[bufferIndex][row] = signature;
+}
+
+// Games often leave most of the screen untouched between frames. If nothing a line depends on changed since its framebuffer row was drawn,
+// the row can be kept. With double buffering that row is 2 frames old, so if it's stale we also check the other framebuffer's row, and copy it over
+bool PPU::reuseLine() {
+    const auto signature = lineSignature();
+    if (signature != lastFrameLines[line]) {
+        frameChanged = true;
+        lastFrameLines[line] = signature;
+    }
+
+    const auto row = outputRow();
+    auto& current = bufferLines[bufferIndex][row];
+    if (current == signature)
+        return true;
+
+    // The signature has the frame's size in it, so rows only match if both framebuffers have the same size
+    if (bufferLines[bufferIndex ^ 1][row] == signature) {
+        const auto rowSize = frameWidth * bytesPerPixel();
+        std::memcpy (&buffers[bufferIndex][row * rowSize], &buffers[bufferIndex ^ 1][row * rowSize], rowSize);
+        current = signature;
+        return true;
+    }
+
+    current = signature;
+    return false;
+}
+
+void PPU::drawLine() {
+    if (drawingFrame) {
+        if (bufferWidth[bufferIndex] != frameWidth || bufferHeight[bufferIndex] != frameHeight) // The buffers got swapped without starting a new frame
+            resizeBuffer (frameWidth, frameHeight);
+
+        if (hiresLine()) {
+            hiresFrame = true;
+            if (frameWidth != 512)
+                resizeBuffer (512, frameHeight);
+        }
+        if (frameHeight == maxFrameHeight)
+            weaveLine();
+    }
+
+    // STAT77 can show the sprite overflow flags at any time, so they're kept up to date even when the line isn't drawn
+    if (!drawingFrame || reuseLine()) {
+        updateOBJFlags();
+        return;
+    }
+
+#ifdef SNES_THREADED_PPU
+    if (renderThread != nullptr) {
+        updateOBJFlags(); // Same here, as the CPU can't see the render thread's flags
+        renderThread->drawLine (*this);
+        return;
+    }
+#endif
+
+    renderScanline();
+}
+
+void PPU::finishFrame() {
+#ifdef SNES_THREADED_PPU
+    if (renderThread != nullptr)
+        renderThread->waitIdle();
+#endif
+    frameDrawn = drawingFrame;
+}
+
+#ifdef SNES_THREADED_PPU
+void PPU::logVRAMWrite (u32 address) {
+    if (renderThread != nullptr)
+        renderThread->logVRAMWrite (address, vram[address]);
+}
+
+void PPU::logCGRAMWrite (u8 index) {
+    if (renderThread != nullptr)
+        renderThread->logCGRAMWrite (index, paletteRAM[index]);
+}
+
+void PPU::logOAMWrite (u16 address) {
+    if (renderThread != nullptr)
+        renderThread->logOAMWrite (address, oam[address]);
+}
+#endif
+
+// Register the PPU's IO registers, as well as the NMI/IRQ and H/V status registers, as their state lives in the PPU
+void PPU::registerMMIO() {
+    MMIO::registerWrite (0x2100, [] (u16 address, u8 value) { Helpers::warn ("Unimplemented write to INIDISP (val: {:02X})\n", value); });
+    MMIO::registerWrite (0x2101, [] (u16 address, u8 value) { // OBJSEL
+        Memory::ppu->objsel.raw = value;
+        Memory::ppu->objListsDirty = true; // Sprite sizes might have changed
+    });
+
+    MMIO::registerWrite (0x2102, 0x2103, [] (u16 address, u8 value) { // OAMADDL, OAMADDH
+        auto& ppu = *Memory::ppu;
+        if (address == 0x2102) ppu.oamaddr.low = value;
+        else ppu.oamaddr.high = value;
+
+        ppu.reloadOAMAddress();
+        ppu.objListsDirty = true; // With priority rotation, OAMADDR picks which sprite gets evaluated first
+    });
+
+    MMIO::registerWrite (0x2104, [] (u16 address, u8 value) { Memory::ppu->writeOAMDATA (value); });
+    MMIO::registerWrite (0x2105, [] (u16 address, u8 value) { Memory::ppu->bgmode.raw = value; });
+    MMIO::registerWrite (0x2106, [] (u16 address, u8 value) { Helpers::warn ("Unimplemented write to mosaic register (val: {:02X})\n", value); });
+
+    MMIO::registerWrite (0x2107, 0x210A, [] (u16 address, u8 value) { Memory::ppu->sc[address - 0x2107].raw = value; }); // BG1SC-BG4SC
+
+    MMIO::registerWrite (0x210B, 0x210C, [] (u16 address, u8 value) { // BG12NBA, BG34NBA
+        const auto index = (address - 0x210B) * 2;
+        Memory::ppu->nba[index] = value & 0xF;
+        Memory::ppu->nba[index + 1] = value >> 4;
+    });
+
+    // BG1HOFS/BG1VOFS to BG4HOFS/BG4VOFS. The BG1 registers double as M7HOFS/M7VOFS
+    MMIO::registerWrite (0x210D, 0x2114, [] (u16 address, u8 value) {
+        auto& ppu = *Memory::ppu;
+        const auto index = (address - 0x210D) >> 1;
+
+        if (address == 0x210D) ppu.m7hofs = ppu.writeMode7Register (value);
+        else if (address == 0x210E) ppu.m7vofs = ppu.writeMode7Register (value);
+
+        if (address & 1) { // HOFS
+            ppu.hofs[index] = (value << 8) | (ppu.old_hofs[index] & ~7) | ((ppu.hofs[index] >> 8) & 7);
+            ppu.old_hofs[index] = value;
+        }
+
+        else { // VOFS
+            ppu.vofs[index] = (value << 8) | ppu.old_vofs[index];
+            ppu.old_vofs[index] = value;
+        }
+    });
+
+    MMIO::registerWrite (0x2115, [] (u16 address, u8 value) { // VMAIN
+        auto& ppu = *Memory::ppu;
+        ppu.vmain.raw = value;
+        switch (value & 3) {
+            case 0: ppu.vramStep = 1; break;
+            case 1: ppu.vramStep = 32; break;
+            default: ppu.vramStep = 128; break;
+        }
+
+        if (value & 0b1100) // Check if VRAM address translation was enabled and panic
+            Helpers::panic ("VRAM address translation\n");
+    });
+
+    MMIO::registerWrite (0x2116, [] (u16 address, u8 value) { Memory::ppu->vmaddr.low = value; }); // VMADDL
+    MMIO::registerWrite (0x2117, [] (u16 address, u8 value) { Memory::ppu->vmaddr.high = value; }); // VMADDH
+
+    MMIO::registerWrite (0x2118, [] (u16 address, u8 value) { // VMDATAL
+        auto& ppu = *Memory::ppu;
+        const auto vmaddr = ppu.vmaddr.raw & 0x7FFF; // The VRAM address we'll access, masked to 15 bits
+        ppu.writeVRAM (vmaddr, (ppu.vram[vmaddr] & 0xFF00) | value); // Write to the low byte of the address
+
+        if (!ppu.vmain.incrementOnHigh) // Increment VRAM address if vmain.7 is not set
+            ppu.vmaddr.raw += ppu.vramStep;
+    });
+
+    MMIO::registerWrite (0x2119, [] (u16 address, u8 value) { // VMDATAH
+        auto& ppu = *Memory::ppu;
+        const auto vmaddr = ppu.vmaddr.raw & 0x7FFF; // The VRAM address we'll access, masked to 15 bits
+        ppu.writeVRAM (vmaddr, (ppu.vram[vmaddr] & 0xFF) | (value << 8)); // Write to the high byte of the address
+
+        if (ppu.vmain.incrementOnHigh) // Increment VRAM address if vmain.7 is set
+            ppu.vmaddr.raw += ppu.vramStep;
+    });
+
+    MMIO::registerWrite (0x211A, [] (u16 address, u8 value) { Memory::ppu->m7sel.raw = value; }); // M7SEL
+
+    MMIO::registerWrite (0x211B, 0x2120, [] (u16 address, u8 value) { // M7A-M7D, M7X, M7Y
+        auto& ppu = *Memory::ppu;
+        const auto data = ppu.writeMode7Register (value);
+
+        switch (address) {
+            case 0x211B: ppu.m7a = data; break;
+            case 0x211C: ppu.m7b = data; break;
+            case 0x211D: ppu.m7c = data; break;
+            case 0x211E: ppu.m7d = data; break;
+            case 0x211F: ppu.m7x = data; break;
+            case 0x2120: ppu.m7y = data; break;
+        }
+
+        // M7A and M7B are also the inputs of the signed multiplication port. Its multiplier is the last byte written to M7B
+        if (address <= 0x211C)
+            Memory::mathEngine.m7_product = (s32) ppu.m7a * (s32) (s8) (ppu.m7b >> 8);
+    });
+
+    MMIO::registerWrite (0x2121, [] (u16 address, u8 value) { // CGADD
+        Memory::ppu->paletteAddr = value;
+        Memory::ppu->paletteLatch = false;
+    });
+
+    MMIO::registerWrite (0x2122, [] (u16 address, u8 value) { Memory::ppu->writeCGDATA (value); });
+
+    MMIO::registerWrite (0x2123, 0x2125, [] (u16 address, u8 value) { Memory::ppu->windowSel[address - 0x2123] = value; }); // W12SEL, W34SEL, WOBJSEL
+    MMIO::registerWrite (0x2126, 0x2129, [] (u16 address, u8 value) { Memory::ppu->windowPos[address - 0x2126] = value; }); // WH0-WH3
+
+    MMIO::registerWrite (0x212A, [] (u16 address, u8 value) { // WBGLOG
+        auto& ppu = *Memory::ppu;
+        ppu.windowLogic = (ppu.windowLogic & 0xFF00) | value;
+    });
+
+    MMIO::registerWrite (0x212B, [] (u16 address, u8 value) { // WOBJLOG
+        auto& ppu = *Memory::ppu;
+        ppu.windowLogic = (ppu.windowLogic & 0xFF) | ((value & 0xF) << 8);
+    });
+
+    MMIO::registerWrite (0x212C, [] (u16 address, u8 value) { Memory::ppu->tm = value; });
+    MMIO::registerWrite (0x212D, [] (u16 address, u8 value) { Memory::ppu->ts = value; });
+    MMIO::registerWrite (0x212E, [] (u16 address, u8 value) { Memory::ppu->tmw = value; });
+    MMIO::registerWrite (0x212F, [] (u16 address, u8 value) { Memory::ppu->tsw = value; });
+    MMIO::registerWrite (0x2130, [] (u16 address, u8 value) { Memory::ppu->cgwsel.raw = value; });
+    MMIO::registerWrite (0x2131, [] (u16 address, u8 value) { Memory::ppu->cgadsub.raw = value; });
+
+    MMIO::registerWrite (0x2132, [] (u16 address, u8 value) { // COLDATA. Bits 5-7 pick which of the R, G and B channels get set to bits 0-4
+        auto& ppu = *Memory::ppu;
+        const u16 intensity = value & 0x1F;
+
+        if (value & 0x20) ppu.fixedColour = (ppu.fixedColour & ~0x001F) | intensity;
+        if (value & 0x40) ppu.fixedColour = (ppu.fixedColour & ~0x03E0) | (intensity << 5);
+        if (value & 0x80) ppu.fixedColour = (ppu.fixedColour & ~0x7C00) | (intensity << 10);
+    });
+
+    MMIO::registerWrite (0x2133, [] (u16 address, u8 value) { Memory::ppu->setini.raw = value; }); // SETINI
+
+    MMIO::registerRead (0x2137, // SLHV (Latch H/V counter)
+        [] (u16 address) -> u8 {
+            Memory::ppu->latchHV (Memory::scheduler->timestamp); // Latch the current HV counters
+            return 0x21; // TODO: Return open bus
+        },
+        [] (u16 address) -> u8 { return 0x21; }
+    );
+
+    MMIO::registerRead (0x2138, // OAMDATAREAD
+        [] (u16 address) -> u8 { return Memory::ppu->readOAMDATA(); },
+        [] (u16 address) -> u8 { const auto& ppu = *Memory::ppu; return ppu.oamAddress >= 0x200 ? ppu.oam[0x200 + (ppu.oamAddress & 0x1F)] : ppu.oam[ppu.oamAddress]; }
+    );
+
+    MMIO::registerRead (0x213C, // OPHCT
+        [] (u16 address) -> u8 { return Memory::ppu->readHCounter(); },
+        [] (u16 address) -> u8 { const auto& ppu = *Memory::ppu; return ppu.hcounterFirstRead ? (ppu.hcounterLatch & 0xFF) : (ppu.hcounterLatch >> 8); }
+    );
+
+    MMIO::registerRead (0x213D, // OPVCT
+        [] (u16 address) -> u8 { return Memory::ppu->readVCounter(); },
+        [] (u16 address) -> u8 { const auto& ppu = *Memory::ppu; return ppu.vcounterFirstRead ? (ppu.vcounterLatch & 0xFF) : (ppu.vcounterLatch >> 8); }
+    );
+
+    MMIO::registerRead (0x213E, // STAT77. The low 4 bits are the PPU1 version
+        [] (u16 address) -> u8 { const auto& ppu = *Memory::ppu; return (ppu.objTimeOver << 7) | (ppu.objRangeOver << 6) | 1; }
+    );
+
+    MMIO::registerRead (0x213F, // STAT78. Bit 7 is the interlace field. TODO: The rest of the flags
+        [] (u16 address) -> u8 { return Memory::ppu->field << 7; }
+    );
+
+    MMIO::registerWrite (0x4200, [] (u16 address, u8 value) { // NMITIMEN
+        auto& ppu = *Memory::ppu;
+        const bool nmiRisingEdge = !(ppu.nmitimen & 0x80) && (value & 0x80); // Check if the NMI enable flag went from 0 to 1
+        ppu.nmitimen = value;
+        if (value & 0x30)
+            Helpers::warn ("Enabled H/V IRQs\n");
+
+        if (nmiRisingEdge && (ppu.rdnmi & 0x80)) // Check if NMIs just got enabled and were already requested, and fire an NMI if so
+            Memory::scheduler->pushEvent (EventTypes::FireNMI, 0); // Timestamp = 0 means it will instantly get executed
+    });
+
+    MMIO::registerRead (0x4210, // RDNMI
+        [] (u16 address) -> u8 {
+            const auto val = Memory::ppu->rdnmi;
+            Memory::ppu->rdnmi &= 0x7F; // Reading from rdnmi acknowledges the NMI and turns bit 7 off
+            return val;
+        },
+        [] (u16 address) -> u8 { return Memory::ppu->rdnmi; }
+    );
+
+    MMIO::registerRead (0x4211, // TIMEUP
+        [] (u16 address) -> u8 {
+            const auto val = Memory::ppu->timeup;
+            Memory::ppu->timeup &= 0x7F; // Reading from timeup acknowledges the IRQ and turns bit 7 off
+            return val;
+        },
+        [] (u16 address) -> u8 { return Memory::ppu->timeup; }
+    );
+
+    MMIO::registerRead (0x4212, // HVBJOY
+        [] (u16 address) -> u8 {
+            Memory::ppu->hvbjoy ^= 1; // We're stubbing the low bit
+            return Memory::ppu->hvbjoy;
+        },
+        [] (u16 address) -> u8 { return Memory::ppu->hvbjoy; }
+    );
+}
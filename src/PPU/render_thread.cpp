@@ -0,0 +1,108 @@
+#include "PPU/render_thread.hpp"
+
+namespace {
+    constexpr int spinCount = 256; // How many times the render thread polls for new commands before going to sleep
+}
+
+PPURenderThread::PPURenderThread (const PPU& ppu) : renderer (ppu) {
+    renderer.renderThread = nullptr; // The copy draws its lines itself
+    renderer.objListsDirty = true;
+    thread = std::thread ([this] { run(); });
+}
+
+PPURenderThread::~PPURenderThread() {
+    quit = true;
+    wake();
+    thread.join();
+}
+
+// Push a command, waiting for the render thread to make room if the queue is full
+void PPURenderThread::push (const Command& command) {
+    while (!commands.push (command)) {
+        wake();
+        std::this_thread::yield();
+    }
+}
+
+void PPURenderThread::wake() {
+    if (sleeping) {
+        std::lock_guard <std::mutex> lock (mutex);
+        wakeUp.notify_one();
+    }
+}
+
+void PPURenderThread::drawLine (const PPU& ppu) {
+    const auto state = ppu.saveLineState();
+
+    while (!lines.push (state)) { // The snapshot has to be in its queue before the command that uses it
+        wake();
+        std::this_thread::yield();
+    }
+
+    push ({ CommandType::DrawLine, 0, 0 });
+    linesQueued++;
+    wake();
+}
+
+void PPURenderThread::waitIdle() {
+    while (linesDrawn.load (std::memory_order_acquire) != linesQueued) {
+        wake();
+        std::this_thread::yield();
+    }
+}
+
+// The render thread doesn't touch the buffers while it's idle, and the next command it pops publishes the new pointers
+void PPURenderThread::setBuffers (const PPU& ppu) {
+    renderer.buffers[0] = ppu.buffers[0];
+    renderer.buffers[1] = ppu.buffers[1];
+}
+
+bool PPURenderThread::waitForCommands() {
+    for (auto i = 0; i < spinCount; i++) { // Lines come in quickly while a frame is running, so spin for a bit first
+        if (!commands.empty()) return true;
+        std::this_thread::yield();
+    }
+
+    std::unique_lock <std::mutex> lock (mutex);
+    sleeping = true;
+    wakeUp.wait (lock, [&] { return !commands.empty() || quit; });
+    sleeping = false;
+
+    return !quit;
+}
+
+void PPURenderThread::run() {
+    Command command;
+
+    while (true) {
+        if (!commands.pop (command)) {
+            if (!waitForCommands())
+                return;
+            continue;
+        }
+
+        switch (command.type) {
+            case CommandType::WriteVRAM:
+                renderer.vram[command.address] = command.value;
+                renderer.tileCache.invalidate (command.address);
+                break;
+
+            case CommandType::WriteCGRAM: renderer.setPalette (command.address, command.value); break;
+
+            case CommandType::WriteOAM:
+                renderer.oam[command.address] = (u8) command.value;
+                renderer.objListsDirty = true;
+                break;
+
+            case CommandType::DrawLine: {
+                PPULineState state;
+                lines.pop (state); // Can't fail, the snapshot was pushed before the command
+
+                renderer.loadLineState (state);
+                renderer.renderScanline();
+                linesDrawn.fetch_add (1, std::memory_order_release);
+                break;
+            }
+        }
+    }
+}
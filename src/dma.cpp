@@ -1,38 +1,167 @@
+#include <algorithm>
 #include "memory.hpp"
 #include "dma.hpp"
+#include "mmio.hpp"
+#include "snes.hpp"
 
-void Memory::doGPDMA (int channel) {
-    const auto params = dmaChannels[channel].params();
-    const auto transferType = params.direction ? DMADirection::IOToCPU : DMADirection::CPUToIO;
-    auto counter = dmaChannels[channel].byteCounter();
-    auto aBusAddress = dmaChannels[channel].currentAddress();
-    auto bBusAddress = dmaChannels[channel].IOAddress();
+namespace {
+    constexpr int hdmaLines = 225; // HDMA runs on lines 0 through 224
 
-    int step;
+    // The B-bus register offset of each byte of a transfer unit, for each unit select value
+    constexpr u8 unitOffsets[8][4] = {
+        { 0 }, { 0, 1 }, { 0, 0 }, { 0, 0, 1, 1 }, { 0, 1, 2, 3 }, { 0, 1, 0, 1 }, { 0, 0 }, { 0, 0, 1, 1 }
+    };
+    constexpr u8 unitLengths[8] = { 1, 2, 2, 4, 4, 4, 2, 4 };
 
-    switch (params.step) { // Calculate the A-Bus address step
-        case 0: step = 1; break; // Increment if step == 0
-        case 2: step = -1; break; // Decrement if step == 2
-        default: step = 0; // Fixed address otherwise 
+    // DMA timings, in master cycles
+    constexpr u64 dmaStartCycles = 18; // Overhead of starting a GPDMA. This is 12 to 24 cycles on hardware, depending on alignment
+    constexpr u64 dmaChannelCycles = 8; // Overhead for each channel that runs
+    constexpr u64 dmaByteCycles = 8; // Cost of each byte transferred
+}
+
+// Call func (pointer, length) for each piece of the A-bus range [address, address + length) that sits in a single fast page
+// Returns false without calling func if part of the range isn't fastmem-mapped, or if it crosses a bank, so the caller can take the slow path
+template <typename Func>
+static bool forEachSourceChunk (u32 address, u32 length, Func func) {
+    if ((address & 0xFFFF) + length > 0x10000)
+        return false;
+
+    for (u32 page = address >> 11; page <= (address + length - 1) >> 11; page++) {
+        if (Memory::pageTableRead[page] == nullptr)
+            return false;
+    }
+
+    while (length != 0) {
+        const auto offset = address & Memory::pageMask;
+        const auto chunk = std::min <u32> (length, Memory::pageSize - offset);
+
+        func (&Memory::pageTableRead[address >> 11][offset], chunk);
+        address += chunk;
+        length -= chunk;
+    }
+
+    return true;
+}
+
+// A-bus -> VMDATAL/VMDATAH, 2 registers write once, with VMAIN set to increment after the high byte. This is how games upload tiles and tilemaps
+static bool bulkVRAMTransfer (u32 aBusAddress, u32 length) {
+    auto& ppu = *Memory::ppu;
+    if (!ppu.vmain.incrementOnHigh || ppu.vmain.translation != 0 || (length & 1))
+        return false;
+
+    bool highByte = false; // Chunks can split a word in 2, if the source crosses a page at an odd address
+    return forEachSourceChunk (aBusAddress, length, [&] (const u8* source, u32 chunk) {
+        if (highByte) { // Finish the word the previous chunk started
+            const auto vmaddr = ppu.vmaddr.raw & 0x7FFF;
+            ppu.writeVRAM (vmaddr, (ppu.vram[vmaddr] & 0xFF) | (*source++ << 8));
+            ppu.vmaddr.raw += ppu.vramStep;
+            chunk--;
+        }
+
+        auto words = chunk / 2;
+        const auto vmaddr = ppu.vmaddr.raw & 0x7FFF;
+        if (ppu.vramStep == 1 && vmaddr + words <= ppu.vram.size()) { // Linear uploads that don't wrap around VRAM are a straight copy
+            if (std::memcmp (&ppu.vram[vmaddr], source, words * 2) != 0) { // Reuploading the same data doesn't make any lines dirty
+                std::memcpy (&ppu.vram[vmaddr], source, words * 2);
+                ppu.vramRangeWritten (vmaddr, words);
+            }
+            ppu.vmaddr.raw += words;
+            source += words * 2;
+            words = 0;
+        }
+
+        for (; words != 0; words--, source += 2) {
+            ppu.writeVRAM (ppu.vmaddr.raw, Helpers::readLE <u16> (source));
+            ppu.vmaddr.raw += ppu.vramStep;
+        }
+
+        highByte = chunk & 1;
+        if (highByte) { // Write the low byte of a word that continues in the next chunk
+            const auto vmaddr = ppu.vmaddr.raw & 0x7FFF;
+            ppu.writeVRAM (vmaddr, (ppu.vram[vmaddr] & 0xFF00) | *source);
+        }
+    });
+}
+
+// A-bus -> CGDATA, 1 register. Used to upload palettes
+static bool bulkCGRAMTransfer (u32 aBusAddress, u32 length) {
+    return forEachSourceChunk (aBusAddress, length, [] (const u8* source, u32 chunk) {
+        for (u32 i = 0; i < chunk; i++)
+            Memory::ppu->writeCGDATA (source[i]);
+    });
+}
+
+// A-bus -> WMDATA, 1 register. Used to copy data into WRAM, or clear it with a fixed source address
+// WRAM is contiguous in host memory whether or not we're using VM fastmem, so we can find all of it via bank $7E's first page
+static bool bulkWRAMTransfer (u32 aBusAddress, u32 length, bool fixedSource) {
+    const auto wram = Memory::pageTableWrite[0x7E0000 >> 11];
+    auto& wramAddress = Memory::wramAddress;
+
+    if (fixedSource) { // Fill
+        const auto source = Memory::pageTableRead[aBusAddress >> 11];
+        if (source == nullptr)
+            return false;
+
+        const auto value = source[aBusAddress & Memory::pageMask];
+        while (length != 0) {
+            const auto chunk = std::min <u32> (length, 0x20000 - wramAddress);
+            std::memset (&wram[wramAddress], value, chunk);
+            wramAddress = (wramAddress + chunk) & 0x1FFFF;
+            length -= chunk;
+        }
+
+        return true;
     }
 
-    fmt::print ("DMA from channel {}.\nByte counter: {:04X}.\nA-Bus address: {:4X}\nB-Bus address: {:4X}\nStep: {}\n", 
-    channel, counter ? counter : 0x10000, aBusAddress, bBusAddress, step);
+    return forEachSourceChunk (aBusAddress, length, [&] (const u8* source, u32 chunk) {
+        while (chunk != 0) { // Copy, wrapping around the end of WRAM
+            const auto size = std::min <u32> (chunk, 0x20000 - wramAddress);
+            std::memcpy (&wram[wramAddress], source, size);
+            wramAddress = (wramAddress + size) & 0x1FFFF;
+            source += size;
+            chunk -= size;
+        }
+    });
+}
+
+// Try to run a transfer through one of the bulk kernels above. Returns false if none of them applies
+static bool doBulkGPDMA (DMAParameters params, u32 aBusAddress, u32 bBusAddress, u32 length) {
+    if (params.direction) // Only CPU -> IO transfers are handled
+        return false;
+
+    const bool increment = params.step == 0;
+    const bool fixed = (params.step & 1) != 0;
+
+    if (params.unitSelect == 1 && bBusAddress == 0x2118 && increment)
+        return bulkVRAMTransfer (aBusAddress, length);
+    if (params.unitSelect == 0 && bBusAddress == 0x2122 && increment)
+        return bulkCGRAMTransfer (aBusAddress, length);
+    if (params.unitSelect == 0 && bBusAddress == 0x2180 && (increment || fixed))
+        return bulkWRAMTransfer (aBusAddress, length, fixed);
+
+    return false;
+}
+
+// Transfer counter bytes of a GPDMA (must be non-zero). Returns the A-bus address after the transfer
+static u32 transferGPDMA (DMAParameters params, u32 aBusAddress, u32 bBusAddress, u32 counter, int step) {
+    using namespace Memory;
+    const auto transferType = params.direction ? DMADirection::IOToCPU : DMADirection::CPUToIO;
+
+    if (doBulkGPDMA (params, aBusAddress, bBusAddress, counter))
+        return aBusAddress + step * counter;
 
     if (transferType == DMADirection::CPUToIO && params.unitSelect == 0) {
         do {
             writeIODMA (bBusAddress, read8(aBusAddress)); // Copy a byte
             aBusAddress += step;
-        } while (--counter); // Using a do-while allows us to copy the hardware, which pre-decrements the byte counter, 
-                            // and for this reason transfer 0x10000 bytes when you set the counter to 0
+        } while (--counter);
     }
 
     else if (transferType == DMADirection::IOToCPU && params.unitSelect == 0) {
         do {
             write8 (aBusAddress, readSlow(bBusAddress)); // Copy a byte
             aBusAddress += step;
-        } while (--counter); // Using a do-while allows us to copy the hardware, which pre-decrements the byte counter, 
-                             // and for this reason transfer 0x10000 bytes when you set the counter to 0
+        } while (--counter);
     }
 
     else if (transferType == DMADirection::CPUToIO && params.unitSelect == 1) {
@@ -80,4 +209,176 @@ void Memory::doGPDMA (int channel) {
         
     else
         Helpers::panic ("Unknown unit select for GPDMA: {}\nDirection: {}", params.unitSelect, transferType);
-}
\ No newline at end of file
+
+    return aBusAddress;
+
+}
+
+void Memory::doGPDMA (int channel) {
+    const auto params = dmaChannels[channel].params();
+    const auto unitLength = unitLengths[params.unitSelect];
+    const auto counter = dmaChannels[channel].byteCounter();
+    auto aBusAddress = dmaChannels[channel].currentAddress();
+    auto bBusAddress = dmaChannels[channel].IOAddress();
+    u32 remaining = counter ? counter : 0x10000; // A byte counter of 0 transfers 0x10000 bytes
+
+    int step;
+
+    switch (params.step) { // Calculate the A-Bus address step
+        case 0: step = 1; break; // Increment if step == 0
+        case 2: step = -1; break; // Decrement if step == 2
+        default: step = 0; // Fixed address otherwise 
+    }
+
+    Helpers::log ("DMA from channel {}.\nByte counter: {:04X}.\nA-Bus address: {:4X}\nB-Bus address: {:4X}\nStep: {}\n", 
+    channel, remaining, aBusAddress, bBusAddress, step);
+
+    scheduler->addCycles (dmaChannelCycles);
+
+    // The CPU is paused while the transfer runs, but the rest of the system isn't. So we split the transfer at the next scheduler event,
+    // making sure H-Blanks and such that fall inside it happen on time. Transfers are split at unit boundaries
+    while (remaining != 0) {
+        g_snes.fireEvents();
+
+        const u64 cyclesUntilEvent = scheduler->nextEventTimestamp - scheduler->timestamp; // Always > 0 after firing events
+        u64 bytes = std::min <u64> (remaining, cyclesUntilEvent / dmaByteCycles + 1);
+        bytes = std::min <u64> (remaining, (bytes + unitLength - 1) / unitLength * unitLength);
+
+        aBusAddress = transferGPDMA (params, aBusAddress, bBusAddress, bytes, step);
+        scheduler->addCycles (bytes * dmaByteCycles);
+        remaining -= bytes;
+    }
+
+    // Write the A-bus address and byte counter back, like the hardware does. The counter always ends at 0
+    dmaChannels[channel].setCurrentAddress ((u16) aBusAddress);
+    dmaChannels[channel].setByteCounter (0);
+}
+
+
+// Walk the channel's HDMA table and turn it into a list of unit transfers, one per line where a transfer happens
+// Register 4-7 (A1T/A1B, DAS/DASB) are the table's start and the indirect bank, 8-A (A2A and NLTR) hold the table state,
+// which we write back once we're done. This means that games reading them mid-frame see the end-of-frame values
+void DMAChannel::parseHDMATable() {
+    const auto parameters = params();
+    const bool indirect = parameters.addrMode;
+    const auto length = unitLengths[parameters.unitSelect];
+    const u32 tableBank = controlRegs[4] << 16;
+    const u32 indirectBank = controlRegs[7] << 16;
+
+    u16 tableAddress = (controlRegs[3] << 8) | controlRegs[2];
+    u16 indirectAddress = (controlRegs[6] << 8) | controlRegs[5];
+    u8 lineCounter = 0;
+    int line = 0;
+
+    hdmaTransfers.clear();
+    hdmaCursor = 0;
+
+    while (line < hdmaLines) {
+        lineCounter = Memory::read8 (tableBank | tableAddress++);
+        if (lineCounter == 0) // A line counter of 0 terminates the table
+            break;
+
+        if (indirect) { // Indirect tables hold a pointer to the data instead of the data itself
+            indirectAddress = Memory::read8 (tableBank | tableAddress++);
+            indirectAddress |= Memory::read8 (tableBank | tableAddress++) << 8;
+        }
+
+        const bool repeat = lineCounter & 0x80; // In repeat mode, a new unit is transferred every line. Otherwise only on the first one
+        const int lines = (lineCounter & 0x7F) ? (lineCounter & 0x7F) : 128;
+
+        for (int i = 0; i < lines && line < hdmaLines; i++, line++) {
+            if (i != 0 && !repeat)
+                continue;
+
+            HDMATransfer transfer { .line = (u16) line };
+            auto& source = indirect ? indirectAddress : tableAddress;
+            const u32 bank = indirect ? indirectBank : tableBank;
+
+            transfer.address = bank | source;
+            if (!parameters.direction) { // CPU -> IO, fetch the data now
+                for (auto j = 0; j < length; j++)
+                    transfer.data[j] = Memory::read8 (bank | (u16) (source + j));
+            }
+
+            source += length;
+            hdmaTransfers.push_back (transfer);
+        }
+    }
+
+    controlRegs[5] = indirectAddress & 0xFF;
+    controlRegs[6] = indirectAddress >> 8;
+    controlRegs[8] = tableAddress & 0xFF;
+    controlRegs[9] = tableAddress >> 8;
+    controlRegs[10] = lineCounter;
+}
+
+// Run this channel's transfers for a line
+void DMAChannel::runHDMA (int line) {
+    const auto parameters = params();
+    const auto offsets = unitOffsets[parameters.unitSelect];
+    const auto length = unitLengths[parameters.unitSelect];
+    const auto bBusAddress = IOAddress();
+
+    for (; hdmaCursor < hdmaTransfers.size() && hdmaTransfers[hdmaCursor].line == line; hdmaCursor++) {
+        const auto& transfer = hdmaTransfers[hdmaCursor];
+
+        for (auto i = 0; i < length; i++) {
+            if (!parameters.direction)
+                Memory::writeIODMA (bBusAddress + offsets[i], transfer.data[i]);
+            else
+                Memory::write8 (transfer.address + i, Memory::readSlow (bBusAddress + offsets[i]));
+        }
+    }
+}
+
+void Memory::initHDMA() {
+    for (auto i = 0; i < 8; i++) {
+        if (hdmaen & (1 << i))
+            dmaChannels[i].parseHDMATable();
+        else
+            dmaChannels[i].hdmaTransfers.clear();
+    }
+
+    doHDMA (0);
+}
+
+void Memory::doHDMA (int line) {
+    if (hdmaen == 0 || line >= hdmaLines)
+        return;
+
+    for (auto i = 0; i < 8; i++) {
+        if (hdmaen & (1 << i))
+            dmaChannels[i].runHDMA (line);
+    }
+}
+
+void DMAChannel::registerMMIO() {
+    MMIO::registerWrite (0x420B, [] (u16 address, u8 value) { // MDMAEN
+        if (value == 0)
+            return;
+
+        g_snes.beginDMA();
+        Memory::scheduler->addCycles (dmaStartCycles);
+
+        for (auto i = 0; i < 8; i++) {
+            if (value & (1 << i)) // Each of the 8 bits signifies whether a DMA channel should fire a GPDMA
+                Memory::doGPDMA (i);
+        }
+
+        g_snes.endDMA();
+    });
+
+    MMIO::registerWrite (0x420C, [] (u16 address, u8 value) { // HDMAEN. Takes effect when the next frame starts
+        Memory::hdmaen = value;
+    });
+
+    for (auto channel = 0; channel < 8; channel++) { // DMA channel control registers
+        const u16 base = 0x4300 + (channel << 4);
+        MMIO::registerWrite (base, base + 0xB, [] (u16 address, u8 value) {
+            const auto channel = (address >> 4) & 0xF;
+            const auto reg = address & 0xF;
+
+            Memory::dmaChannels[channel].controlRegs[reg] = value;
+        });
+    }
+}
@@ -16,10 +16,15 @@ PPU* Memory::ppu = nullptr;
 Scheduler* Memory::scheduler = nullptr;
 MathEngine Memory::mathEngine;
 DMAChannel Memory::dmaChannels[8];
+u8 Memory::hdmaen = 0;
 SPC700 Memory::apu;
+AudioBuffer Memory::audioBuffer;
 
 // Memory areas
 std::array <u8, 128 * Memory::kilobyte> Memory::wram;
+std::array <uint8_t*, Memory::pageCount> Memory::pageTableRead;
+std::array <uint8_t*, Memory::pageCount> Memory::pageTableWrite;
+u32 Memory::wramAddress = 0;
 
 // Joypad.hpp
 u16 Joypads::pad1 = 0;
@@ -0,0 +1,12 @@
+#include "joypad.hpp"
+#include "mmio.hpp"
+
+void Joypads::registerMMIO() {
+    // Automatic reading joypad ports
+    MMIO::registerRead (0x4218, [] (u16 address) -> u8 { return pad1 & 0xFF; }); // Joypad 1 (Low)
+    MMIO::registerRead (0x4219, [] (u16 address) -> u8 { return pad1 >> 8; }); // Joypad 1 (High)
+    MMIO::registerRead (0x421A, 0x421F, [] (u16 address) -> u8 { return 0; }); // Joypads 2 to 4 (Unimplemented)
+
+    // Manual reading joypad ports
+    MMIO::registerRead (0x4016, 0x4017, [] (u16 address) -> u8 { return 0; }); // Joypad Input Register A and B (unimplemented)
+}
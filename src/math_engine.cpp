@@ -0,0 +1,37 @@
+#include "math_engine.hpp"
+#include "memory.hpp"
+#include "mmio.hpp"
+
+void MathEngine::registerMMIO() {
+    MMIO::registerRead (0x2134, 0x2136, [] (u16 address) -> u8 { // MPYL, MPYM, MPYH
+        return (u8) (Memory::mathEngine.m7_product >> ((address - 0x2134) * 8));
+    });
+
+    MMIO::registerWrite (0x4202, [] (u16 address, u8 value) { Memory::mathEngine.multiplicand = value; }); // WRMPYA
+    MMIO::registerWrite (0x4203, [] (u16 address, u8 value) { // WRMPYB
+        auto& mathEngine = Memory::mathEngine;
+        mathEngine.multiplier = value;
+        mathEngine.division_remainder_multiplication_product = (u16) mathEngine.multiplicand * (u16) mathEngine.multiplier;
+    });
+
+    MMIO::registerWrite (0x4204, [] (u16 address, u8 value) { // WRDIVL
+        Memory::mathEngine.dividend = (Memory::mathEngine.dividend & 0xFF00) | value;
+    });
+
+    MMIO::registerWrite (0x4205, [] (u16 address, u8 value) { // WRDIVH
+        Memory::mathEngine.dividend = (Memory::mathEngine.dividend & 0x00FF) | (value << 8);
+    });
+
+    MMIO::registerWrite (0x4206, [] (u16 address, u8 value) { // WRDIVB
+        auto& mathEngine = Memory::mathEngine;
+        mathEngine.divisor = value;
+        mathEngine.quotient = (value) ? 0xFFFF : (u16) mathEngine.dividend / (u16) mathEngine.divisor; // Quotient is 0xFFFF is divisor is 0, else it's dividend/divisor
+        // Similarly for remainder, it's equal to the dividend if divisor == 0, else it's equal to the dividend % divisor
+        mathEngine.division_remainder_multiplication_product = (value) ? mathEngine.dividend : (u16) mathEngine.dividend % (u16) mathEngine.divisor;
+    });
+
+    MMIO::registerRead (0x4214, [] (u16 address) -> u8 { return Memory::mathEngine.quotient & 0xFF; }); // RDDIVL
+    MMIO::registerRead (0x4215, [] (u16 address) -> u8 { return Memory::mathEngine.quotient >> 8; }); // RDDIVH
+    MMIO::registerRead (0x4216, [] (u16 address) -> u8 { return Memory::mathEngine.division_remainder_multiplication_product & 0xFF; }); // RDMPYL
+    MMIO::registerRead (0x4217, [] (u16 address) -> u8 { return Memory::mathEngine.division_remainder_multiplication_product >> 8; }); // RDMPYH
+}
@@ -0,0 +1,24 @@
+#include "mmio.hpp"
+
+std::array <MMIO::Handlers, MMIO::bBusRegisterCount + MMIO::cpuRegisterCount> MMIO::handlers;
+
+void MMIO::registerRead (u16 start, u16 end, ReadHandler read, ReadHandler peek) {
+    for (u32 address = start; address <= end; address++) {
+        const auto index = slot (address);
+        if (index == -1)
+            Helpers::panic ("[MMIO] Tried to register read handler for non-register address {:04X}\n", address);
+
+        handlers[index].read = read;
+        handlers[index].peek = peek ? peek : read;
+    }
+}
+
+void MMIO::registerWrite (u16 start, u16 end, WriteHandler write) {
+    for (u32 address = start; address <= end; address++) {
+        const auto index = slot (address);
+        if (index == -1)
+            Helpers::panic ("[MMIO] Tried to register write handler for non-register address {:04X}\n", address);
+
+        handlers[index].write = write;
+    }
+}
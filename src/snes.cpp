@@ -11,6 +11,19 @@ SNES::SNES() {
     db >> Memory::gameDB;
     Memory::ppu = &ppu;
     Memory::scheduler = &scheduler;
+
+    // Set up the IO register handlers of every subsystem
+    PPU::registerMMIO();
+    MathEngine::registerMMIO();
+    DMAChannel::registerMMIO();
+    SPC700::registerMMIO();
+    Joypads::registerMMIO();
+    Memory::registerMMIO();
+
+#ifdef SNES_THREADED_PPU
+    renderThread = std::make_unique <PPURenderThread> (ppu);
+    ppu.renderThread = renderThread.get();
+#endif
 }
 
 void SNES::reset() { // TODO: Reset APU, PPU, scheduler, etc
@@ -18,59 +31,107 @@ void SNES::reset() { // TODO: Reset APU, PPU, scheduler, etc
     Memory::apu = SPC700();
 }
 
+// Run the CPU in batches up to the next scheduler event, instead of polling the scheduler after every instruction
 void SNES::runFrame() {
-    while (!frameDone)
-        step();
+    applyVRAMEdits();
+    while (!frameDone) {
+        cpu.run();
+        fireEvents();
+    }
 
     frameDone = false;
 }
 
+// Step a single instruction (or block, with the dynarec/cached interpreter). Used by the debugger
 void SNES::step() {
+    applyVRAMEdits();
     cpu.step();
     scheduler.addCycles (cpu.cycles * 6); // Assume 1 CPU cycle = 6 master clock cycles (This depends on memory waitstates, we're assuming we're always running @3.58MHz)
+    fireEvents();
+}
+
+void SNES::queueVRAMEdit (u32 address, u8 value) {
+    std::lock_guard <std::mutex> lock (vramEditMutex);
+    vramEdits.push_back ({ address, value });
+}
+
+// Apply the queued VRAM editor writes. They need to invalidate the decoded tiles they touch
+void SNES::applyVRAMEdits() {
+    std::lock_guard <std::mutex> lock (vramEditMutex);
+    auto vram = (u8*) ppu.vram.data();
+
+    for (const auto& edit : vramEdits) {
+        vram[edit.address] = edit.value;
+        ppu.vramWritten (edit.address >> 1);
+    }
+
+    vramEdits.clear();
+}
 
-    while (true) {
+// Fire all events that are due
+void SNES::fireEvents() {
+    while (scheduler.timestamp >= scheduler.nextEventTimestamp) {
         const auto e = scheduler.next();
-        if (scheduler.timestamp >= e.timestamp) { // Check if any events should be fired
-            scheduler.removeNext();
-            switch (e.type) {
-                case EventTypes::HBlank:
-                    if (ppu.line < 224)
-                        ppu.renderScanline();
-                    ppu.hvbjoy |= 0x40; // Set HBlank flag in HVBJoy
-                    scheduler.pushEvent (EventTypes::EndOfLine, e.timestamp + 258); // Schedule end of line event
-                    break;
-
-                case EventTypes::EndOfLine:
-                    ppu.cycleLineStarted = e.timestamp; // Back up the timestamp the current line started
-                    ppu.line += 1; // Increment PPU line counter
-                    ppu.hvbjoy &= ~0x40; // Turn off H-Blank flag in hvbjoy
-
-                    if (ppu.line == 224) { // Check if we just entered vblank
-                        frameDone = true; // We can go back to the frontend real quick
-                        ppu.rdnmi |= 0x80; // Request VBlank NMI
-                        ppu.hvbjoy |= 0x80; // Turn on V-Blank flag in hvbjoy
-
-                        if (ppu.nmitimen & 0x80) // Fire NMI if they're enabled
-                            cpu.fireNMI();
-                    }
+        scheduler.removeNext();
+        switch (e.type) {
+            case EventTypes::HBlank:
+                if (ppu.line < 224)
+                    ppu.drawLine();
+                Memory::doHDMA (ppu.line + 1); // HDMA transfers happen during HBlank, so they affect the next line
+                ppu.hvbjoy |= 0x40; // Set HBlank flag in HVBJoy
+                scheduler.pushEvent (EventTypes::EndOfLine, e.timestamp + 258); // Schedule end of line event
+                break;
+
+            case EventTypes::EndOfLine:
+                ppu.cycleLineStarted = e.timestamp; // Back up the timestamp the current line started
+                ppu.line += 1; // Increment PPU line counter
+                ppu.hvbjoy &= ~0x40; // Turn off H-Blank flag in hvbjoy
+
+                if (ppu.line == 224) { // Check if we just entered vblank
+                    frameDone = true; // We can go back to the frontend real quick
+                    ppu.finishFrame(); // Make sure the frame's done rendering before the frontend gets it
+                    ppu.rdnmi |= 0x80; // Request VBlank NMI
+                    ppu.hvbjoy |= 0x80; // Turn on V-Blank flag in hvbjoy
+                    ppu.reloadOAMAddress(); // The OAM address gets reset to OAMADDR at the start of VBlank
+
+                    if (ppu.nmitimen & 0x80) // Fire NMI if they're enabled
+                        fireNMI();
+
+                    // Games stop touching the APU ports once their sound driver is running, so catch the APU up every frame
+                    // to keep the DSP producing samples at the real rate
+                    Memory::apu.catchUp (e.timestamp);
+                }
  
-                    else if (ppu.line == 262) { // Check if we're leaving vblank
-                        ppu.line = 0;
-                        ppu.rdnmi &= 0x7F; // Remove VBlank NMI request
-                        ppu.hvbjoy &= 0x7F; // Turn off V-Blank flag in hvbjoy
-                    }
-
-                    scheduler.pushEvent (EventTypes::HBlank, e.timestamp + 1106); // Schedule next HBlank
-                    break;
-                    
-                case EventTypes::FireNMI: cpu.fireNMI(); break;
-
-                default: Helpers::panic ("Unhandled event: {}\n", e.name());
-            }
+                else if (ppu.line == 262) { // Check if we're leaving vblank
+                    ppu.line = 0;
+                    ppu.rdnmi &= 0x7F; // Remove VBlank NMI request
+                    ppu.hvbjoy &= 0x7F; // Turn off V-Blank flag in hvbjoy
+                    ppu.objRangeOver = ppu.objTimeOver = false; // The sprite overflow flags get cleared at the end of VBlank
+                    Memory::initHDMA(); // Reload the HDMA tables for the new frame
+                    ppu.startFrame();
+                }
+
+                scheduler.pushEvent (EventTypes::HBlank, e.timestamp + 1106); // Schedule next HBlank
+                break;
+                
+            case EventTypes::FireNMI: fireNMI(); break;
+
+            default: Helpers::panic ("Unhandled event: {}\n", e.name());
         }
+    }
+}
 
-        else 
-            break;
+void SNES::fireNMI() {
+    if (inDMA)
+        nmiDelayed = true;
+    else
+        cpu.fireNMI();
+}
+
+void SNES::endDMA() {
+    inDMA = false;
+    if (nmiDelayed) { // Fire the NMI as soon as the CPU is done with the instruction that started the DMA
+        nmiDelayed = false;
+        scheduler.pushEvent (EventTypes::FireNMI, scheduler.timestamp);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "memory.hpp"
+
+// Host virtual memory fastmem (x86-64 Linux only)
+// We reserve 16MB of host address space and map WRAM, ROM and SRAM into it, so that every mirror of a region aliases the same physical pages.
+// The mappings are derived from the software page tables, which stay the source of truth, and only host pages that are entirely backed
+// by one contiguous, host page-aligned chunk of memory get mapped. Everything else (IO, open bus, small SRAM mirrors...) is left PROT_NONE.
+// Writes to ROM are caught the same way, as ROM pages are mapped read-only.
+//
+// The fast accessors below are written in assembly, so that we know exactly which instruction touches the SNES address space.
+// When one of them faults, the SIGSEGV handler points RIP to the page table-based handler for the same access.
+// As the accessors don't touch the stack or the argument registers, this is the same as if they had tail called it.
+
+u8* Memory::fastmemBase = nullptr;
+
+namespace {
+    constexpr size_t addressSpaceSize = 0x1000000; // 24-bit address bus
+    constexpr size_t reservedSize = addressSpaceSize + 0x10000; // Leave a PROT_NONE guard after the end for word accesses at $FFFFFF
+
+    size_t hostPageSize = 0;
+    struct sigaction oldHandler; // The SIGSEGV handler that was installed before ours. Faults that aren't ours get forwarded to it
+
+    // Memory backing each region. WRAM keeps its contents across ROM loads, while ROM and SRAM get remapped every time
+    int wramFd = -1;
+    u8* wramBacking = nullptr;
+    int romFd = -1;
+    u8* romBacking = nullptr;
+    size_t romBackingSize = 0;
+    int sramFd = -1;
+
+    u8 readFallback8 (u32 address) { return Memory::readPaged8 (address); }
+    u16 readFallback16 (u32 address) { return Memory::readPaged16 (address); }
+    void writeFallback8 (u32 address, u8 value) { Memory::writePaged8 (address, value); }
+    void writeFallback16 (u32 address, u16 value) { Memory::writePaged16 (address, value); }
+}
+
+// Fast accessors. Argument 1 (edi) is the address, argument 2 (esi) is the value to write
+// The base pointer is referenced through an assembler alias so we don't have to spell out its mangled name
+asm (R"(
+    .set snesFastmemBase, _ZN6Memory11fastmemBaseE
+
+    .text
+    .p2align 4
+    .globl snesVMRead8, snesVMRead8Access
+    .hidden snesVMRead8, snesVMRead8Access
+snesVMRead8:
+    movl %edi, %eax
+    andl $0xFFFFFF, %eax
+    movq snesFastmemBase(%rip), %rcx
+snesVMRead8Access:
+    movzbl (%rcx, %rax), %eax
+    ret
+
+    .p2align 4
+    .globl snesVMRead16, snesVMRead16Access
+    .hidden snesVMRead16, snesVMRead16Access
+snesVMRead16:
+    movl %edi, %eax
+    andl $0xFFFFFF, %eax
+    movq snesFastmemBase(%rip), %rcx
+snesVMRead16Access:
+    movzwl (%rcx, %rax), %eax
+    ret
+
+    .p2align 4
+    .globl snesVMWrite8, snesVMWrite8Access
+    .hidden snesVMWrite8, snesVMWrite8Access
+snesVMWrite8:
+    movl %edi, %eax
+    andl $0xFFFFFF, %eax
+    movq snesFastmemBase(%rip), %rcx
+snesVMWrite8Access:
+    movb %sil, (%rcx, %rax)
+    ret
+
+    .p2align 4
+    .globl snesVMWrite16, snesVMWrite16Access
+    .hidden snesVMWrite16, snesVMWrite16Access
+snesVMWrite16:
+    movl %edi, %eax
+    andl $0xFFFFFF, %eax
+    movq snesFastmemBase(%rip), %rcx
+snesVMWrite16Access:
+    movw %si, (%rcx, %rax)
+    ret
+)");
+
+extern "C" {
+    extern const char snesVMRead8Access[], snesVMRead16Access[], snesVMWrite8Access[], snesVMWrite16Access[];
+}
+
+static void segfaultHandler (int signal, siginfo_t* info, void* context) {
+    const auto faultAddress = (u8*) info->si_addr;
+    auto& rip = ((ucontext_t*) context)->uc_mcontext.gregs[REG_RIP];
+
+    if (faultAddress >= Memory::fastmemBase && faultAddress < Memory::fastmemBase + reservedSize) {
+        const auto pc = (const char*) rip;
+
+        if (pc == snesVMRead8Access) { rip = (greg_t) &readFallback8; return; }
+        if (pc == snesVMRead16Access) { rip = (greg_t) &readFallback16; return; }
+        if (pc == snesVMWrite8Access) { rip = (greg_t) &writeFallback8; return; }
+        if (pc == snesVMWrite16Access) { rip = (greg_t) &writeFallback16; return; }
+    }
+
+    // Not one of ours, forward it to whoever was there before us
+    if (oldHandler.sa_flags & SA_SIGINFO)
+        oldHandler.sa_sigaction (signal, info, context);
+    else if (oldHandler.sa_handler != SIG_DFL && oldHandler.sa_handler != SIG_IGN)
+        oldHandler.sa_handler (signal);
+    else { // Restore the default handler and return, so the faulting instruction crashes us properly
+        std::signal (SIGSEGV, SIG_DFL);
+    }
+}
+
+// Reserve our address space, set up the WRAM backing and install the SIGSEGV handler
+static void reserveAddressSpace() {
+    hostPageSize = sysconf (_SC_PAGESIZE);
+    if (hostPageSize % Memory::pageSize != 0)
+        Helpers::panic ("[VM fastmem] Host page size ({} bytes) is not a multiple of our page size\n", hostPageSize);
+
+    void* memory = mmap (nullptr, reservedSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+        Helpers::panic ("[VM fastmem] Failed to reserve address space\n");
+    Memory::fastmemBase = (u8*) memory;
+
+    wramFd = memfd_create ("snes-wram", 0);
+    if (wramFd == -1 || ftruncate (wramFd, Memory::wram.size()) != 0)
+        Helpers::panic ("[VM fastmem] Failed to create WRAM backing\n");
+
+    wramBacking = (u8*) mmap (nullptr, Memory::wram.size(), PROT_READ | PROT_WRITE, MAP_SHARED, wramFd, 0);
+    if (wramBacking == MAP_FAILED)
+        Helpers::panic ("[VM fastmem] Failed to map WRAM backing\n");
+    std::memcpy (wramBacking, Memory::wram.data(), Memory::wram.size()); // From now on, WRAM lives in the backing instead of Memory::wram
+
+    struct sigaction action {};
+    action.sa_sigaction = &segfaultHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset (&action.sa_mask);
+    if (sigaction (SIGSEGV, &action, &oldHandler) != 0)
+        Helpers::panic ("[VM fastmem] Failed to install SIGSEGV handler\n");
+}
+
+// Copy the ROM into a fresh memfd, so it can be mapped at every mirror. Also open the save file, for SRAM
+static void createCartBackings() {
+    if (romBacking != nullptr)
+        munmap (romBacking, romBackingSize);
+    if (romFd != -1)
+        close (romFd);
+    if (sramFd != -1)
+        close (sramFd);
+
+    const auto& rom = Memory::cart.rom;
+    romBackingSize = std::max <size_t> ((rom.size() + hostPageSize - 1) & ~(hostPageSize - 1), hostPageSize);
+
+    romFd = memfd_create ("snes-rom", 0);
+    if (romFd == -1 || ftruncate (romFd, romBackingSize) != 0)
+        Helpers::panic ("[VM fastmem] Failed to create ROM backing\n");
+
+    romBacking = (u8*) mmap (nullptr, romBackingSize, PROT_READ | PROT_WRITE, MAP_SHARED, romFd, 0);
+    if (romBacking == MAP_FAILED)
+        Helpers::panic ("[VM fastmem] Failed to map ROM backing\n");
+    std::memcpy (romBacking, rom.data(), rom.size());
+
+    // SRAM is already a memory mapped save file, so we map the same file again. Both mappings are shared, so they stay coherent
+    sramFd = -1;
+    if (Memory::cart.hasBattery && Memory::cart.saveFile.exists())
+        sramFd = open (Memory::cart.saveFile.filepath().c_str(), O_RDWR);
+}
+
+// Point a page table entry into the backing memory instead of Memory::wram and the ROM vector
+static u8* rebase (u8* pointer) {
+    const auto& rom = Memory::cart.rom;
+
+    if (pointer >= Memory::wram.data() && pointer < Memory::wram.data() + Memory::wram.size())
+        return wramBacking + (pointer - Memory::wram.data());
+    if (!rom.empty() && pointer >= rom.data() && pointer < rom.data() + rom.size())
+        return romBacking + (pointer - rom.data());
+
+    return pointer;
+}
+
+// Find which file and offset a page table entry refers to. Returns false if it's not memory we can map
+static bool findBacking (const u8* pointer, int& fd, size_t& offset) {
+    const auto sram = Memory::cart.sram;
+    const auto sramSize = Memory::cart.ramSize * 1024;
+
+    if (pointer >= wramBacking && pointer < wramBacking + Memory::wram.size()) {
+        fd = wramFd;
+        offset = pointer - wramBacking;
+    } else if (pointer >= romBacking && pointer < romBacking + romBackingSize) {
+        fd = romFd;
+        offset = pointer - romBacking;
+    } else if (sramFd != -1 && pointer >= sram && pointer < sram + sramSize) {
+        fd = sramFd;
+        offset = pointer - sram;
+    } else
+        return false;
+
+    return true;
+}
+
+void Memory::mapVirtualFastmem() {
+    if (fastmemBase == nullptr)
+        reserveAddressSpace();
+    createCartBackings();
+
+    for (auto& pointer : pageTableRead) pointer = rebase (pointer);
+    for (auto& pointer : pageTableWrite) pointer = rebase (pointer);
+
+    // Wipe the previous ROM's mappings
+    if (mmap (fastmemBase, reservedSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+        Helpers::panic ("[VM fastmem] Failed to unmap address space\n");
+
+    const auto pagesPerHostPage = hostPageSize / pageSize;
+    for (size_t hostPage = 0; hostPage < addressSpaceSize; hostPage += hostPageSize) {
+        const auto firstPage = hostPage / pageSize;
+        const auto readPointer = pageTableRead[firstPage];
+        int fd;
+        size_t offset;
+
+        if (readPointer == nullptr || !findBacking (readPointer, fd, offset) || offset % hostPageSize != 0)
+            continue;
+
+        // Every page in this host page needs to be contiguous in the backing, and either read-only or read/write to the same memory
+        bool mappable = true;
+        bool writable = true;
+        for (size_t i = 0; i < pagesPerHostPage; i++) {
+            const auto read = pageTableRead[firstPage + i];
+            const auto write = pageTableWrite[firstPage + i];
+
+            mappable &= (read == readPointer + i * pageSize) && (write == nullptr || write == read);
+            writable &= (write == read);
+        }
+
+        if (!mappable)
+            continue;
+
+        const int protection = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        if (mmap (fastmemBase + hostPage, hostPageSize, protection, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED)
+            Helpers::panic ("[VM fastmem] Failed to map host page {:06X}\n", hostPage);
+    }
+}